@@ -0,0 +1,9 @@
+// Blink the LEDs, spending nearly all the time in delay().
+#include <Esplora.h>
+void setup() { }
+void loop() {
+  Esplora.writeRGB(255, 0, 0);
+  delay(500);
+  Esplora.writeRGB(0, 0, 255);
+  delay(500);
+}
@@ -0,0 +1,111 @@
+// Measure what it costs to hand control to the sketch and back, as
+// embed_run_for does for every step: a Fiber resume and yield, and for
+// comparison the same round trip to a thread through a condition variable.
+// Each runs for --seconds of wall time, and one JSON object is printed, e.g.
+//
+//   {"fiber_switch_ns": 4.1, "thread_switch_ns": 6200.0}
+//
+// where a round trip is two switches.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "Fiber.h"
+
+namespace {
+
+double
+monotonic_seconds() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+_sim::Fiber fiber;
+
+void
+yield_forever(void*) {
+  for (;;) {
+    fiber.yield();
+  }
+}
+
+// Round trips in batches, so that reading the clock doesn't count.
+const long BATCH = 10000;
+
+double
+fiber_switch_ns(double seconds) {
+  fiber.start(yield_forever, nullptr, 64 * 1024);
+  long trips = 0;
+  double start = monotonic_seconds();
+  double elapsed;
+  do {
+    for (long i = 0; i < BATCH; i++) {
+      fiber.resume();
+    }
+    trips += BATCH;
+    elapsed = monotonic_seconds() - start;
+  } while (elapsed < seconds);
+  return elapsed * 1e9 / (2 * trips);
+}
+
+double
+thread_switch_ns(double seconds) {
+  std::mutex mutex;
+  std::condition_variable cv;
+  long turn = 0;
+  bool done = false;
+  std::thread other([&] {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+      cv.wait(lock, [&] { return turn % 2 == 1 || done; });
+      if (done) {
+        return;
+      }
+      turn++;
+      cv.notify_all();
+    }
+  });
+
+  long trips = 0;
+  double start = monotonic_seconds();
+  double elapsed;
+  do {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (long i = 0; i < BATCH / 100; i++) {
+      turn++;
+      cv.notify_all();
+      cv.wait(lock, [&] { return turn % 2 == 0; });
+    }
+    trips += BATCH / 100;
+    lock.unlock();
+    elapsed = monotonic_seconds() - start;
+  } while (elapsed < seconds);
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    done = true;
+    cv.notify_all();
+  }
+  other.join();
+  return elapsed * 1e9 / (2 * trips);
+}
+
+} // namespace
+
+int
+main(int argc, char** argv) {
+  double seconds = 2;
+  if (argc == 3 && strcmp(argv[1], "--seconds") == 0) {
+    seconds = atof(argv[2]);
+  } else if (argc != 1) {
+    fprintf(stderr, "usage: %s [--seconds S]\n", argv[0]);
+    return 2;
+  }
+  double fiber_ns = fiber_switch_ns(seconds / 2);
+  double thread_ns = thread_switch_ns(seconds / 2);
+  printf("{\"fiber_switch_ns\": %.1f, \"thread_switch_ns\": %.1f}\n", fiber_ns, thread_ns);
+  return 0;
+}
@@ -0,0 +1,18 @@
+// Log a row of sensor readings as numbers, in decimal, hex and fixed point.
+#include <Esplora.h>
+unsigned long count = 0;
+void setup() {
+  Serial.begin(9600);
+}
+void loop() {
+  int slider = Esplora.readSlider();
+  Serial.print(count++);
+  Serial.print('\t');
+  Serial.print(slider);
+  Serial.print('\t');
+  Serial.print(slider, HEX);
+  Serial.print('\t');
+  Serial.print(micros());
+  Serial.print('\t');
+  Serial.println(slider * 5.0 / 1023, 3);
+}
@@ -0,0 +1,116 @@
+// Measure how fast the JSON parser gets through recorded client event logs.
+//
+// Each file holds one JSON array of events per line, as the client sends
+// them. Every line is parsed repeatedly for --seconds of wall time, and one
+// JSON object per file is printed, e.g.
+//
+//   {"log": "events.jsonl", "lines": 2193, "events": ..., "mb_per_s": ...,
+//    "lines_per_s": ..., "events_per_s": ...}
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "json.h"
+
+static double
+monotonic_seconds(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static char *
+read_file(const char *path, size_t *nbytes) {
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) {
+    return NULL;
+  }
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  char *data = malloc(size + 1);
+  if (data == NULL || fread(data, 1, size, f) != (size_t)size) {
+    free(data);
+    fclose(f);
+    return NULL;
+  }
+  data[size] = '\0';
+  fclose(f);
+  *nbytes = size;
+  return data;
+}
+
+// Parses every line once, returning how many events were parsed or -1 if a
+// line isn't valid JSON.
+static long
+parse_lines(const char *data, size_t nbytes, long *nlines) {
+  const char *end = data + nbytes;
+  long nevents = 0;
+  *nlines = 0;
+  for (const char *line = data; line < end; ) {
+    const char *line_end = memchr(line, '\n', end - line);
+    if (line_end == NULL) {
+      line_end = end;
+    }
+    if (line_end != line) {
+      struct json_value *json = json_parse_n(line, line_end - line);
+      if (json == NULL) {
+        return -1;
+      }
+      for (const struct json_value_list *event = json->as.pairs; event != NULL; event = event->next) {
+        nevents++;
+      }
+      json_value_destroy(json);
+      (*nlines)++;
+    }
+    line = line_end + 1;
+  }
+  return nevents;
+}
+
+int
+main(int argc, char **argv) {
+  double seconds = 1.0;
+  int first = 1;
+  if (argc > 2 && strcmp(argv[1], "--seconds") == 0) {
+    seconds = atof(argv[2]);
+    first = 3;
+  }
+  if (first >= argc) {
+    fprintf(stderr, "usage: %s [--seconds N] events.jsonl...\n", argv[0]);
+    return 2;
+  }
+
+  for (int i = first; i < argc; i++) {
+    size_t nbytes;
+    char *data = read_file(argv[i], &nbytes);
+    if (data == NULL) {
+      fprintf(stderr, "Couldn't read %s\n", argv[i]);
+      return 1;
+    }
+
+    long nlines = 0;
+    long nevents = 0;
+    long passes = 0;
+    double start = monotonic_seconds();
+    double elapsed;
+    do {
+      nevents = parse_lines(data, nbytes, &nlines);
+      if (nevents < 0) {
+        fprintf(stderr, "%s has a line that isn't valid JSON\n", argv[i]);
+        return 1;
+      }
+      passes++;
+      elapsed = monotonic_seconds() - start;
+    } while (elapsed < seconds);
+
+    const char *name = strrchr(argv[i], '/') ? strrchr(argv[i], '/') + 1 : argv[i];
+    printf("{\"log\": \"%s\", \"lines\": %ld, \"events\": %ld, \"mb_per_s\": %.1f, "
+           "\"lines_per_s\": %.0f, \"events_per_s\": %.0f}\n",
+           name, nlines, nevents, passes * nbytes / elapsed / 1e6,
+           passes * nlines / elapsed, passes * nevents / elapsed);
+    free(data);
+  }
+  return 0;
+}
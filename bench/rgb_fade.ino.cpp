@@ -0,0 +1,11 @@
+// Fade the RGB LED through colours with analogWrite.
+#include <Esplora.h>
+void setup() { }
+void loop() {
+  for (int i = 0; i < 256; i++) {
+    analogWrite(5, i);
+    analogWrite(10, 255 - i);
+    analogWrite(9, i / 2);
+    delay(2);
+  }
+}
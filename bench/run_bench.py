@@ -0,0 +1,105 @@
+#!/usr/bin/env python3
+# Run benchmark sketches in fast mode and report how quickly they simulate.
+#
+# Each binary is started with -f and driven the way the GUI drives it: the
+# updates and client events go over pipes, and a resume is sent whenever the
+# simulator suspends after an update. After --seconds of wall time the run is
+# stopped with SIGINT, and one JSON object per sketch is printed, e.g.
+#
+#   {"sketch": "button_poll", "wall_s": 2.01, "virtual_us": 5300000,
+#    "virtual_us_per_s": ..., "api_calls": ..., "api_calls_per_s": ...,
+#    "updates": ..., "updates_per_s": ..., "string_allocs": ...,
+#    "string_allocs_per_s": ..., "cpu_s": ..., "peak_rss_kb": ...}
+import argparse
+import json
+import os
+import select
+import signal
+import subprocess
+import sys
+import time
+
+# Updates after which the simulator waits for a resume in fast mode.
+SUSPENDING = (b'"arduino_pins"', b'"arduino_heartbeat"', b'"random_state"', b'"marker_failure"')
+RESUME = b'[{"type": "resume", "data": {}}]\n'
+
+
+def run(binary, seconds, args):
+    client_r, client_w = os.pipe()
+    updates_r, updates_w = os.pipe()
+    os.set_inheritable(client_r, True)
+    os.set_inheritable(updates_w, True)
+    env = dict(os.environ, GROK_CLIENT_PIPE=str(client_r), GROK_UPDATES_PIPE=str(updates_w))
+
+    start = time.monotonic()
+    proc = subprocess.Popen([binary, '-f'] + args, env=env, close_fds=False,
+                            stdout=subprocess.DEVNULL)
+    os.close(client_r)
+    os.close(updates_w)
+
+    updates = 0
+    tail = b''
+    bye = None
+    interrupted = False
+    while True:
+        timeout = max(0, start + seconds - time.monotonic()) if not interrupted else None
+        ready, _, _ = select.select([updates_r], [], [], timeout)
+        if not ready:
+            proc.send_signal(signal.SIGINT)
+            interrupted = True
+            continue
+        chunk = os.read(updates_r, 1 << 16)
+        if not chunk:
+            break
+        updates += chunk.count(b'\n')
+        lines = (tail + chunk).split(b'\n')
+        tail = lines.pop()
+        for line in lines:
+            if b'"arduino_bye"' in line:
+                bye = json.loads(line)[0]
+        if any(kind in chunk for kind in SUSPENDING):
+            try:
+                os.write(client_w, RESUME)
+            except OSError:
+                pass
+
+    _, status, usage = os.wait4(proc.pid, 0)
+    wall = time.monotonic() - start
+    os.close(updates_r)
+    os.close(client_w)
+    if bye is None:
+        raise RuntimeError('%s exited with status %d without saying bye' % (binary, status))
+
+    virtual_us = bye['ticks'] * 1000
+    api_calls = bye['data']['api_calls']
+    string_allocs = bye['data']['stats']['strings']['allocs']
+    return {
+        'sketch': os.path.basename(binary),
+        'wall_s': round(wall, 3),
+        'virtual_us': virtual_us,
+        'virtual_us_per_s': round(virtual_us / wall),
+        'api_calls': api_calls,
+        'api_calls_per_s': round(api_calls / wall),
+        'updates': updates,
+        'updates_per_s': round(updates / wall),
+        'string_allocs': string_allocs,
+        'string_allocs_per_s': round(string_allocs / wall),
+        'cpu_s': round(usage.ru_utime + usage.ru_stime, 3),
+        'peak_rss_kb': usage.ru_maxrss,
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Benchmark Esplora sketches in fast mode.')
+    parser.add_argument('--seconds', type=float, default=2.0, help='wall time to run each sketch for')
+    parser.add_argument('--args', default='', help='extra simulator options, e.g. "-w"')
+    parser.add_argument('binaries', nargs='+')
+    opts = parser.parse_args()
+
+    for binary in opts.binaries:
+        print(json.dumps(run(binary, opts.seconds, opts.args.split())))
+        sys.stdout.flush()
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,11 @@
+// Print a line to Serial on every loop without any delay.
+#include <Esplora.h>
+unsigned long count = 0;
+void setup() {
+  Serial.begin(9600);
+}
+void loop() {
+  Serial.print("count: ");
+  Serial.println(count++);
+  Serial.println(Esplora.readSlider());
+}
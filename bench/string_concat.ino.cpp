@@ -0,0 +1,15 @@
+// Build lines with String concatenation, the way most sketches format output.
+#include <Esplora.h>
+unsigned long count = 0;
+String label = "slider";
+void setup() {
+  Serial.begin(9600);
+}
+void loop() {
+  int slider = Esplora.readSlider();
+  Serial.println("Value: " + String(slider));
+  Serial.println(label + ": " + slider + " of " + 1023);
+  String line = String(count++) + ", " + String(slider, HEX) + ", " + label;
+  line += String(" (") + millis() + " ms)";
+  Serial.println(line);
+}
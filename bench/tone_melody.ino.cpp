@@ -0,0 +1,12 @@
+// Play a short melody on the buzzer, over and over.
+#include <Esplora.h>
+const unsigned int notes[] = { 262, 294, 330, 349, 392, 440, 494, 523 };
+void setup() { }
+void loop() {
+  for (unsigned int i = 0; i < sizeof(notes) / sizeof(notes[0]); i++) {
+    Esplora.tone(notes[i], 100);
+    delay(130);
+  }
+  Esplora.noTone();
+  delay(500);
+}
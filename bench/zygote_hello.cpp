@@ -0,0 +1,285 @@
+// Measure how long a run takes to say arduino_hello, from the moment a client
+// asks for one: spawning esplora-sim for it, asking esplora-sim -z for its
+// built-in sketch, and asking esplora-zygote -z to load sketch.so, all from
+// the given build directory (see src/inc/Zygote.h). Each is repeated for a
+// third of --seconds of wall time, and one JSON object of median and 90th
+// percentile microseconds is printed, e.g.
+//
+//   {"runs": 3000, "spawn_hello_us": 1500.0, "spawn_hello_p90_us": ...,
+//    "zygote_hello_us": 150.0, ..., "zygote_so_hello_us": 250.0, ...}
+//
+// Each run stops itself after 1 ms of Arduino time in fast mode.
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+extern char** environ;
+
+namespace {
+
+const char* const RUN_ARGS[] = {"-f", "-l", "1"};
+const size_t NUM_RUN_ARGS = sizeof(RUN_ARGS) / sizeof(RUN_ARGS[0]);
+// How long to leave between runs, for the zygote to fork its next child.
+const useconds_t IDLE_US = 2000;
+
+double
+monotonic_seconds() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+void
+fail(const char* what) {
+  fprintf(stderr, "%s: %s\n", what, strerror(errno));
+  exit(EXIT_FAILURE);
+}
+
+// Read updates until the hello, or until they end if drain.
+void
+read_updates(int updates_fd, bool drain) {
+  std::string got;
+  char buf[65536];
+  for (;;) {
+    if (!drain && got.find("\"arduino_hello\"") != std::string::npos) {
+      return;
+    }
+    ssize_t n = read(updates_fd, buf, sizeof(buf));
+    if (n <= 0) {
+      if (drain) {
+        return;
+      }
+      fprintf(stderr, "The run ended without a hello\n");
+      exit(EXIT_FAILURE);
+    }
+    if (!drain) {
+      got.append(buf, n);
+    }
+  }
+}
+
+pid_t
+spawn(const std::vector<std::string>& args, char** env) {
+  std::vector<char*> argv;
+  for (const std::string& arg : args) {
+    argv.push_back(const_cast<char*>(arg.c_str()));
+  }
+  argv.push_back(nullptr);
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+  pid_t pid;
+  int err = posix_spawn(&pid, argv[0], &actions, nullptr, argv.data(), env);
+  posix_spawn_file_actions_destroy(&actions);
+  if (err != 0) {
+    errno = err;
+    fail(argv[0]);
+  }
+  return pid;
+}
+
+double
+spawn_run(const std::string& build_dir) {
+  int client[2], updates[2];
+  if (pipe2(client, O_CLOEXEC) == -1 || pipe2(updates, O_CLOEXEC) == -1) {
+    fail("pipe");
+  }
+  // The run's ends are inherited under the same numbers, so they mustn't be
+  // close on exec.
+  fcntl(client[0], F_SETFD, 0);
+  fcntl(updates[1], F_SETFD, 0);
+  std::vector<std::string> env_strings;
+  for (char** e = environ; *e; e++) {
+    env_strings.push_back(*e);
+  }
+  env_strings.push_back("GROK_CLIENT_PIPE=" + std::to_string(client[0]));
+  env_strings.push_back("GROK_UPDATES_PIPE=" + std::to_string(updates[1]));
+  std::vector<char*> env;
+  for (std::string& e : env_strings) {
+    env.push_back(&e[0]);
+  }
+  env.push_back(nullptr);
+  std::vector<std::string> args = {build_dir + "/esplora-sim"};
+  args.insert(args.end(), RUN_ARGS, RUN_ARGS + NUM_RUN_ARGS);
+
+  double start = monotonic_seconds();
+  pid_t pid = spawn(args, env.data());
+  close(client[0]);
+  close(updates[1]);
+  read_updates(updates[0], false);
+  double elapsed = monotonic_seconds() - start;
+
+  read_updates(updates[0], true);
+  waitpid(pid, nullptr, 0);
+  close(updates[0]);
+  close(client[1]);
+  return elapsed;
+}
+
+int
+connect_to(const std::string& path) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+  int conn = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (conn == -1) {
+    fail("socket");
+  }
+  if (connect(conn, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == -1) {
+    close(conn);
+    return -1;
+  }
+  return conn;
+}
+
+double
+zygote_run(const std::string& path, const std::string& sketch) {
+  int client[2], updates[2];
+  if (pipe2(client, O_CLOEXEC) == -1 || pipe2(updates, O_CLOEXEC) == -1) {
+    fail("pipe");
+  }
+  std::string request = sketch + '\0';
+  for (size_t i = 0; i < NUM_RUN_ARGS; i++) {
+    request += RUN_ARGS[i];
+    request += '\0';
+  }
+
+  double start = monotonic_seconds();
+  int conn = connect_to(path);
+  if (conn == -1) {
+    fail(path.c_str());
+  }
+  struct iovec iov;
+  iov.iov_base = &request[0];
+  iov.iov_len = request.size();
+  char control[CMSG_SPACE(2 * sizeof(int))];
+  memset(control, 0, sizeof(control));
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(2 * sizeof(int));
+  int fds[2] = {client[0], updates[1]};
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+  if (sendmsg(conn, &msg, 0) == -1) {
+    fail("sendmsg");
+  }
+  close(client[0]);
+  close(updates[1]);
+  char reply[1024];
+  ssize_t n = recv(conn, reply, sizeof(reply) - 1, 0);
+  close(conn);
+  if (n < 3 || strncmp(reply, "ok ", 3) != 0) {
+    reply[std::max<ssize_t>(n, 0)] = 0;
+    fprintf(stderr, "The zygote said: %s\n", reply);
+    exit(EXIT_FAILURE);
+  }
+  read_updates(updates[0], false);
+  double elapsed = monotonic_seconds() - start;
+
+  read_updates(updates[0], true);
+  close(updates[0]);
+  close(client[1]);
+  return elapsed;
+}
+
+pid_t
+serve(const std::string& binary, const std::string& path) {
+  pid_t pid = spawn({binary, "-z", path}, environ);
+  int conn;
+  while ((conn = connect_to(path)) == -1) {
+    usleep(10000);
+  }
+  // An empty request, which the child it reaches turns down.
+  close(conn);
+  return pid;
+}
+
+struct Times {
+  double median_us;
+  double p90_us;
+  size_t runs;
+};
+
+template <typename Run>
+Times
+repeat(double seconds, Run run) {
+  std::vector<double> times;
+  double start = monotonic_seconds();
+  while (times.empty() || monotonic_seconds() - start < seconds) {
+    times.push_back(run() * 1e6);
+    usleep(IDLE_US);
+  }
+  std::sort(times.begin(), times.end());
+  return Times{times[times.size() / 2], times[times.size() * 9 / 10], times.size()};
+}
+
+} // namespace
+
+int
+main(int argc, char** argv) {
+  double seconds = 2;
+  std::string build_dir = "build";
+  int arg = 1;
+  if (arg + 1 < argc && strcmp(argv[arg], "--seconds") == 0) {
+    seconds = atof(argv[arg + 1]);
+    arg += 2;
+  }
+  if (arg < argc) {
+    build_dir = argv[arg++];
+  }
+  if (arg != argc) {
+    fprintf(stderr, "usage: %s [--seconds S] [BUILD_DIR]\n", argv[0]);
+    return 2;
+  }
+  // Neither server nor run is ever waited for by the other.
+  signal(SIGPIPE, SIG_IGN);
+
+  char tmp[] = "/tmp/zygote_hello.XXXXXX";
+  if (!mkdtemp(tmp)) {
+    fail("mkdtemp");
+  }
+  std::string builtin_path = std::string(tmp) + "/builtin.sock";
+  std::string so_path = std::string(tmp) + "/so.sock";
+  char sketch[PATH_MAX];
+  if (!realpath((build_dir + "/sketch.so").c_str(), sketch)) {
+    fail("sketch.so");
+  }
+  pid_t builtin = serve(build_dir + "/esplora-sim", builtin_path);
+  pid_t so = serve(build_dir + "/esplora-zygote", so_path);
+
+  Times spawned = repeat(seconds / 3, [&] { return spawn_run(build_dir); });
+  Times zygote = repeat(seconds / 3, [&] { return zygote_run(builtin_path, ""); });
+  Times zygote_so = repeat(seconds / 3, [&] { return zygote_run(so_path, sketch); });
+
+  kill(builtin, SIGTERM);
+  kill(so, SIGTERM);
+  waitpid(builtin, nullptr, 0);
+  waitpid(so, nullptr, 0);
+  rmdir(tmp);
+
+  printf("{\"runs\": %zu, \"spawn_hello_us\": %.1f, \"spawn_hello_p90_us\": %.1f, \"zygote_hello_us\": %.1f, "
+         "\"zygote_hello_p90_us\": %.1f, \"zygote_so_hello_us\": %.1f, \"zygote_so_hello_p90_us\": %.1f}\n",
+         spawned.runs + zygote.runs + zygote_so.runs, spawned.median_us, spawned.p90_us, zygote.median_us,
+         zygote.p90_us, zygote_so.median_us, zygote_so.p90_us);
+  return 0;
+}
@@ -8,18 +8,18 @@
 
 void pinMode(int pin, int mode) {
   if (pin > NUM_PINS || pin < 0) {
-    _sim::increment_counter(1);
+    _sim::increment_counter(1, _sim::API_PIN);
     return;
   }
   if (mode == INPUT || mode == INPUT_PULLUP || mode == OUTPUT) {
     _sim::_device.set_pin_mode(pin, mode);
   }
-  _sim::increment_counter(1);
+  _sim::increment_counter(1, _sim::API_PIN);
 }
 
 void digitalWrite(int pin, byte value) {
   if (pin > NUM_PINS || pin < 0) {
-    _sim::increment_counter(1);
+    _sim::increment_counter(1, _sim::API_PIN);
     return;
   }
   int mode = _sim::_device.get_pin_mode(pin);
@@ -30,17 +30,17 @@ void digitalWrite(int pin, byte value) {
   } else if (mode == OUTPUT) {
     _sim::_device.set_digital(pin, (value) ? HIGH : LOW);
   }
-  _sim::increment_counter(4);
+  _sim::increment_counter(4, _sim::API_PIN);
 }
 
 int digitalRead(int pin) {
-  _sim::increment_counter(1);
+  _sim::increment_counter(1, _sim::API_PIN);
   return _sim::_device.get_digital(pin);
 }
 
 void analogWrite(int pin, byte value) {
   if (!_sim::_device.digitalPinHasPWM(pin)) {
-    _sim::increment_counter(1);
+    _sim::increment_counter(1, _sim::API_ANALOG);
     return;
   }
 
@@ -54,11 +54,11 @@ void analogWrite(int pin, byte value) {
     _sim::_device.default_pwm_period(pin);
     _sim::_device.set_pwm_high_time(pin, value);
   }
-  _sim::increment_counter(10);
+  _sim::increment_counter(10, _sim::API_ANALOG);
 }
 
 int analogRead(int pin) {
-  _sim::increment_counter(100);
+  _sim::increment_counter(100, _sim::API_ANALOG);
   if (pin >= 0 && pin <= 11) pin += 18;
   return _sim::_device.get_analog(pin);
 }
@@ -70,16 +70,16 @@ void analogReference(uint8_t mode __attribute__((unused))) {
 //------ Advanced I/O ----------------------
 void tone(unsigned int pin, unsigned int freq) {
   if (!_sim::_device.digitalPinHasPWM(pin)) {
-    _sim::increment_counter(1);
+    _sim::increment_counter(1, _sim::API_TONE);
     return;
   }
   pinMode(pin, OUTPUT);
   _sim::_device.set_tone(pin, freq);
-  _sim::increment_counter(1);
+  _sim::increment_counter(1, _sim::API_TONE);
 }
 
 void tone(unsigned int pin, unsigned int freq, unsigned long duration) {
-  _sim::increment_counter(1);
+  _sim::increment_counter(1, _sim::API_TONE);
   if (!_sim::_device.digitalPinHasPWM(pin))
     return;
   tone(pin, freq);
@@ -91,12 +91,12 @@ void noTone(unsigned int pin) {
 }
 
 void shiftOut(int dataPin __attribute__((unused)), int clockPin __attribute__((unused)), int bitOrder __attribute__((unused)), int value __attribute__((unused))) {
-  _sim::increment_counter(1);
+  _sim::increment_counter(1, _sim::API_PIN);
   //bitOrder: which order to shift out the bits; either MSBFIRST or LSBFIRST.
 }
 
 int shiftIn(int dataPin __attribute__((unused)), int clockPin __attribute__((unused)), int bitOrder __attribute__((unused))) {
-  _sim::increment_counter(1);
+  _sim::increment_counter(1, _sim::API_PIN);
   //bitOrder: which order to shift out the bits; either MSBFIRST or LSBFIRST.
   return 0;
 }
@@ -105,7 +105,8 @@ int shiftIn(int dataPin __attribute__((unused)), int clockPin __attribute__((unu
 //------ Time ------------------------------
 
 unsigned long millis() {
-  _sim::increment_counter(1);
+  _sim::increment_counter(1, _sim::API_TIME);
+  _sim::_device.note_activity();
   unsigned long e = _sim::_device.get_micros();
   return e / 1000;
 }
@@ -114,7 +115,8 @@ unsigned long millis() {
 // to the nearest multiple of 4
 unsigned long
 micros() {
-  _sim::increment_counter(1);
+  _sim::increment_counter(1, _sim::API_TIME);
+  _sim::_device.note_activity();
   unsigned long e = _sim::_device.get_micros();
   int rem = e % 4;
   if (rem == 0)
@@ -124,12 +126,12 @@ micros() {
 
 
 void delay(uint32_t ms) {
-  _sim::increment_counter(ms*1000);
+  _sim::increment_counter(ms*1000, _sim::API_DELAY);
 
 }
 
 void delayMicroseconds(uint32_t us) {
-  _sim::increment_counter(us);
+  _sim::increment_counter(us, _sim::API_DELAY);
 }
 
 int map(int x, int fromLow, int fromHigh, int toLow, int toHigh) {
@@ -142,19 +144,20 @@ int map(int x, int fromLow, int fromHigh, int toLow, int toHigh) {
 
 //------ Random Numbers --------------------
 void randomSeed(int seed) {
-  _sim::increment_counter(1);
+  _sim::increment_counter(1, _sim::API_RANDOM);
   srand(seed);
 }
 
 long random(long upperLimit) {
-  _sim::increment_counter(2);
+  _sim::increment_counter(2, _sim::API_RANDOM);
+  _sim::_device.note_activity();
   long x = RAND_MAX / upperLimit;
   x = long(rand() / x);
   return x;
 }
 
 long random(long lowerLimit, long upperLimit) {
-  _sim::increment_counter(2);
+  _sim::increment_counter(2, _sim::API_RANDOM);
   long interval, temp = 0;
   if (lowerLimit < upperLimit) {
     interval = upperLimit - lowerLimit;
@@ -0,0 +1,116 @@
+/*
+  Budget.cpp - CPU and virtual time budgets for the Arduino simulator
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "Budget.h"
+
+#include <time.h>
+#include <sys/resource.h>
+#include "Clock.h"
+
+namespace _sim {
+
+namespace {
+
+// The CPU share is measured over windows of this much real time, so that a
+// burst early in the run doesn't earn unlimited credit later.
+const uint64_t SHARE_WINDOW_US = 1000000;
+// Seconds of grace past the CPU limit before the kernel kills us outright.
+// This only matters if the sketch spins without calling into the simulator.
+const rlim_t CPU_RLIMIT_GRACE = 2;
+
+uint64_t cpu_limit_us = 0;
+uint64_t virtual_limit_us = 0;
+double cpu_share = 0;
+
+uint64_t window_real_us = 0;
+uint64_t window_cpu_us = 0;
+
+// If this window has used more than its share of the CPU, sleep until it
+// hasn't.
+void
+throttle(uint64_t cpu_us) {
+  uint64_t real_us = monotonic_micros();
+  if (window_real_us == 0 || real_us - window_real_us > SHARE_WINDOW_US) {
+    window_real_us = real_us;
+    window_cpu_us = cpu_us;
+    return;
+  }
+  uint64_t allowed_real_us = (cpu_us - window_cpu_us) / cpu_share;
+  uint64_t elapsed_us = real_us - window_real_us;
+  if (allowed_real_us > elapsed_us) {
+    uint64_t sleep_us = allowed_real_us - elapsed_us;
+    struct timespec t;
+    t.tv_sec = sleep_us / 1000000;
+    t.tv_nsec = (sleep_us % 1000000) * 1000;
+    nanosleep(&t, NULL);
+  }
+}
+
+} // namespace
+
+void
+budget_set_cpu_limit(uint64_t us) {
+  cpu_limit_us = us;
+  if (us == 0) {
+    return;
+  }
+  // Back up the cooperative check with a hard limit from the kernel.
+  struct rlimit limit;
+  limit.rlim_cur = (us + 999999) / 1000000 + CPU_RLIMIT_GRACE;
+  limit.rlim_max = limit.rlim_cur + 1;
+  setrlimit(RLIMIT_CPU, &limit);
+}
+
+void
+budget_set_virtual_limit(uint64_t us) {
+  virtual_limit_us = us;
+}
+
+void
+budget_set_cpu_share(double share) {
+  cpu_share = share;
+}
+
+const char*
+budget_check(uint64_t arduino_us, uint64_t* limit, uint64_t* used) {
+  if (cpu_limit_us == 0 && virtual_limit_us == 0 && cpu_share == 0) {
+    return nullptr;
+  }
+  uint64_t cpu_us = thread_cpu_micros();
+  if (cpu_share > 0) {
+    throttle(cpu_us);
+  }
+  if (cpu_limit_us != 0 && cpu_us > cpu_limit_us) {
+    *limit = cpu_limit_us;
+    *used = cpu_us;
+    return "cpu";
+  }
+  if (virtual_limit_us != 0 && arduino_us > virtual_limit_us) {
+    *limit = virtual_limit_us;
+    *used = arduino_us;
+    return "virtual";
+  }
+  return nullptr;
+}
+
+uint64_t
+thread_cpu_micros() {
+  struct timespec t;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+  return static_cast<uint64_t>(t.tv_sec) * 1000000 + t.tv_nsec / 1000;
+}
+
+} // namespace _sim
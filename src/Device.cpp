@@ -16,6 +16,8 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include "Device.h"
+#include "EdgeLog.h"
+#include "Timeline.h"
 #include "global_variables.h"
 
 #include <iostream>
@@ -27,8 +29,26 @@ double dmap(double val, double x1, double x2, double y1, double y2) {
 }
 
 _Device::_Device() {
+  reset();
+}
+
+void _Device::reset() {
   _micros_elapsed = 0;
   _micros_since_heartbeat = 0;
+  _us_since_sync = 0;
+  _countdowns_active = 0;
+  _pins.fill(Pin());
+  _mux_pins.fill(MPin());
+  _isr_table.fill(nullptr);
+  _detecting_idle = false;
+  _idle_generation = 1;
+  _idle_reads = 0;
+  _idle_seen.fill(0);
+  _idle_values.fill(0);
+  _watching_outputs = false;
+  _output_changed = false;
+  _output_change_us = 0;
+  _expiry_us = 0;
 
   for (int i = 0; i < NUM_PINS; i++) {
     _pins[i]._pin = i;
@@ -52,16 +72,32 @@ _Device::_Device() {
 }
 
 void _Device::process_countdown(uint32_t us) {
+  // this runs on every increment, so skip the scan when no tone is timed
+  if (_countdowns_active == 0)
+    return;
   std::lock_guard<std::mutex> lk(_m_countdown);
+  // Tones that run out during this step are ended soonest first, so that
+  // their edges are logged in time order.
+  uint64_t step_start_us = _micros_elapsed - us;
+  for (;;) {
+    int next = -1;
+    for (int i = 0; i < NUM_PINS; i++) {
+      if (_pins[i]._countdown > 0 && _pins[i]._countdown <= us &&
+          (next == -1 || _pins[i]._countdown < _pins[next]._countdown))
+        next = i;
+    }
+    if (next == -1)
+      break;
+    _expiry_us = step_start_us + _pins[next]._countdown;
+    _pins[next]._countdown = 0;
+    _countdowns_active--;
+    // timer has expired on pin next
+    set_tone(next, 0);
+    _expiry_us = 0;
+  }
   for (int i = 0; i < NUM_PINS; i++) {
-    if (_pins[i]._countdown > 0) {
+    if (_pins[i]._countdown > 0)
       _pins[i]._countdown -= us;
-      if (_pins[i]._countdown <= 0) {
-        _pins[i]._countdown = 0;
-        // timer has expired on pin i
-        set_tone(i, 0);
-      }
-    }
   }
 }
 
@@ -75,8 +111,11 @@ uint64_t _Device::get_micros() {
 }
 
 void _Device::set_pin_voltage(int pin, int value) {
-  std::lock_guard<std::mutex> lk(_m_pins);
-  _pins[pin]._voltage = value;
+  {
+    std::lock_guard<std::mutex> lk(_m_pins);
+    _pins[pin]._voltage = value;
+  }
+  note_activity();
 }
 
 double _Device::get_pin_voltage(int pin) {
@@ -85,8 +124,13 @@ double _Device::get_pin_voltage(int pin) {
 }
 
 void _Device::set_mux_voltage(int pin, double value) {
-  std::lock_guard<std::mutex> lk(_m_mux);
-  _mux_pins[pin]._voltage = value;
+  {
+    std::lock_guard<std::mutex> lk(_m_mux);
+    _mux_pins[pin]._voltage = value;
+  }
+  if (_sim::timeline_recording)
+    _sim::timeline_mux(_micros_elapsed, pin, value);
+  note_activity();
 }
 
 double _Device::get_mux_voltage(int pin) {
@@ -96,8 +140,13 @@ double _Device::get_mux_voltage(int pin) {
 
 
 int _Device::get_mux_value(int pin) {
-  std::lock_guard<std::mutex> lk(_m_mux);
-  return round(dmap(_mux_pins[pin]._voltage, 0, 5.0, 0, 1023));
+  int value;
+  {
+    std::lock_guard<std::mutex> lk(_m_mux);
+    value = round(dmap(_mux_pins[pin]._voltage, 0, 5.0, 0, 1023));
+  }
+  note_read(pin, value);
+  return value;
 }
 
 
@@ -105,7 +154,9 @@ void _Device::set_pin_mode(int pin, int mode) {
   int curr_mode = get_pin_mode(pin);
   if (curr_mode == mode)
     return;
+  note_activity();
   std::lock_guard<std::mutex> lk(_m_pins);
+  PinState prev_state = _pins[pin]._state;
   switch (mode) {
     case INPUT:
       _pins[pin]._state = GPIO_PIN_INPUT_FLOATING;
@@ -123,6 +174,8 @@ void _Device::set_pin_mode(int pin, int mode) {
       return;
   }
   _pins[pin]._mode = mode;
+  if (_pins[pin]._state != prev_state)
+    record_edge(pin);
 }
 
 int _Device::get_pin_mode(int pin) {
@@ -132,7 +185,10 @@ int _Device::get_pin_mode(int pin) {
 
 void _Device::set_pin_state(int pin, PinState state) {
   std::lock_guard<std::mutex> lk(_m_pins);
+  PinState prev_state = _pins[pin]._state;
   _pins[pin]._state = state;
+  if (state != prev_state)
+    note_output(pin);
 }
 
 PinState _Device::get_pin_state(int pin) {
@@ -142,6 +198,8 @@ PinState _Device::get_pin_state(int pin) {
 
 void _Device::set_pwm_high_time(int pin, uint32_t a_write) {
   std::lock_guard<std::mutex> lk(_m_pins);
+  PinState prev_state = _pins[pin]._state;
+  uint32_t prev_high_time = _pins[pin]._pwm_high_time;
   set_output(pin);
   if (a_write == 0) {
     _pins[pin]._state = GPIO_PIN_OUTPUT_LOW;
@@ -153,6 +211,8 @@ void _Device::set_pwm_high_time(int pin, uint32_t a_write) {
   }
   uint32_t high_time = _pins[pin]._pwm_period * (static_cast<float>(a_write) / 255.0);
   _pins[pin]._pwm_high_time = high_time;
+  if (_pins[pin]._state != prev_state || high_time != prev_high_time)
+    note_output(pin);
 }
 
 uint32_t _Device::get_pwm_high_time(int pin) {
@@ -162,7 +222,10 @@ uint32_t _Device::get_pwm_high_time(int pin) {
 
 void _Device::set_pwm_period(int pin, uint32_t period) {
   std::lock_guard<std::mutex> lk(_m_pins);
+  uint32_t prev_period = _pins[pin]._pwm_period;
   _pins[pin]._pwm_period = period;
+  if (period != prev_period)
+    note_output(pin);
 }
 
 uint32_t _Device::get_pwm_period(int pin) {
@@ -182,37 +245,51 @@ void _Device::default_pwm_period(int pin) {
 void _Device::set_digital(int pin, int level) {
   set_output(pin);
   std::lock_guard<std::mutex> lk(_m_pins);
-  _pins[pin]._state = (level == LOW) ? GPIO_PIN_OUTPUT_LOW : GPIO_PIN_OUTPUT_HIGH;
+  PinState state = (level == LOW) ? GPIO_PIN_OUTPUT_LOW : GPIO_PIN_OUTPUT_HIGH;
+  PinState prev_state = _pins[pin]._state;
+  _pins[pin]._state = state;
+  if (state != prev_state)
+    note_output(pin);
 }
 
 int _Device::get_digital(int pin) {
   std::lock_guard<std::mutex> lk(_m_pins);
   Pin p = _pins[pin];
+  int value;
   if (std::isnan(p._voltage)) {
     if (p._mode == INPUT_PULLUP) {
       p._voltage = 5.0;
-      return HIGH;
-    } else
+      value = HIGH;
+    } else {
+      // floating pins read noise, which is never idle
+      note_activity();
       return (rand() % 2 == 0) ? HIGH : LOW;
+    }
+  } else if (p._mode == INPUT) {
+    value = (p._voltage >= 3.0) ? HIGH : LOW;
+  } else if (p._mode == INPUT_PULLUP) {
+    value = (p._voltage >= 1.0) ? HIGH : LOW;
+  } else if (p._mode == OUTPUT) {
+    value = (p._state == GPIO_PIN_OUTPUT_HIGH) ? HIGH : LOW;
+  } else {
+    note_activity();
+    return (rand() % 2 == 0) ? HIGH : LOW;
   }
-  if (p._mode == INPUT)
-    return (p._voltage >= 3.0) ? HIGH : LOW;
-  else if (p._mode == INPUT_PULLUP)
-    return (p._voltage >= 1.0) ? HIGH : LOW;
-  else if (p._mode == OUTPUT)
-    return (p._state == GPIO_PIN_OUTPUT_HIGH) ? HIGH : LOW;
-  return (rand() % 2 == 0) ? HIGH : LOW;
+  note_read(MUX_PINS + pin, value);
+  return value;
 }
 
 uint32_t _Device::get_analog(int pin) {
   std::lock_guard<std::mutex> lk(_m_pins);
   if (pin >= 0 && pin <= 11)
     pin += 18;
-  if (std::isnan(_pins[pin]._voltage))
+  if (std::isnan(_pins[pin]._voltage) || !_pins[pin]._is_analog) {
+    note_activity();
     return rand() % 1024;
-  if (_pins[pin]._is_analog)
-    return round(dmap(_pins[pin]._voltage, 0, 5.0, 0, 1023));
-  return rand() % 1024;
+  }
+  uint32_t value = round(dmap(_pins[pin]._voltage, 0, 5.0, 0, 1023));
+  note_read(MUX_PINS + NUM_PINS + pin, value);
+  return value;
 }
 
 void _Device::set_tone(int pin, uint32_t freq) {
@@ -237,7 +314,11 @@ bool _Device::is_tone(int pin) {
 
 void _Device::set_countdown(int pin, uint32_t d) {
   std::lock_guard<std::mutex> lk(_m_countdown);
+  if (_pins[pin]._countdown > 0)
+    _countdowns_active--;
   _pins[pin]._countdown = d;
+  if (d > 0)
+    _countdowns_active++;
 }
 
 void _Device::set_pullup_digwrite(int pin, int value) {
@@ -251,6 +332,10 @@ void _Device::set_pullup_digwrite(int pin, int value) {
     if (state >= GPIO_PIN_INPUT_UP_LOW && state <= GPIO_PIN_INPUT_DOWN_HIGH)
       _pins[pin]._state = GPIO_PIN_INPUT_FLOATING;
   }
+  if (_pins[pin]._state != state) {
+    note_activity();
+    record_edge(pin);
+  }
 }
 
 bool _Device::digitalPinHasPWM(int p) {
@@ -271,6 +356,102 @@ void _Device::set_output(int pin) {
   _pins[pin]._is_pwm = false;
 }
 
+// The idle detector considers the sketch idle once it has made IDLE_READS
+// consecutive reads that each returned the same value as an earlier read of
+// the same source, with no outputs or input changes in between. Anything that
+// could make the sketch behave differently calls note_activity() to start a
+// new generation.
+// _m_idle is a leaf lock, so these can be called with any other lock held.
+// Only called before the sketch starts, so _detecting_idle is read without
+// the lock.
+void _Device::detect_idle() {
+  _detecting_idle = true;
+}
+
+void _Device::note_read(int source, int value) {
+  if (!_detecting_idle)
+    return;
+  std::lock_guard<std::mutex> lk(_m_idle);
+  if (_idle_seen[source] == _idle_generation) {
+    if (_idle_values[source] == value) {
+      if (_idle_reads < IDLE_READS)
+        _idle_reads++;
+      return;
+    }
+    _idle_generation++;
+    _idle_reads = 0;
+  }
+  _idle_seen[source] = _idle_generation;
+  _idle_values[source] = value;
+}
+
+void _Device::note_activity() {
+  if (!_detecting_idle)
+    return;
+  std::lock_guard<std::mutex> lk(_m_idle);
+  _idle_generation++;
+  _idle_reads = 0;
+}
+
+// An output the client can see has changed, and pin now holds its new
+// state. This is activity as far as the idle detector is concerned, and may
+// be the reaction being timed.
+void _Device::note_output(int pin) {
+  record_edge(pin);
+  std::lock_guard<std::mutex> lk(_m_idle);
+  _idle_generation++;
+  _idle_reads = 0;
+  if (_watching_outputs) {
+    _watching_outputs = false;
+    _output_changed = true;
+    _output_change_us = _micros_elapsed;
+  }
+}
+
+// Log the pin's new state in the edge log and the timeline, if they're on.
+// Called with _m_pins held.
+void _Device::record_edge(int pin) {
+  if (!_sim::edge_logging && !_sim::timeline_recording)
+    return;
+  const Pin& p = _pins[pin];
+  uint64_t us = _expiry_us ? _expiry_us : _micros_elapsed.load();
+  if (_sim::edge_logging)
+    _sim::edge_log_record(us, pin, p._state, p._pwm_high_time, p._pwm_period);
+  if (_sim::timeline_recording)
+    _sim::timeline_pin(us, pin, p._state, p._pwm_high_time, p._pwm_period);
+}
+
+void _Device::watch_outputs() {
+  std::lock_guard<std::mutex> lk(_m_idle);
+  _watching_outputs = true;
+  _output_changed = false;
+}
+
+bool _Device::output_changed(uint64_t* us) {
+  std::lock_guard<std::mutex> lk(_m_idle);
+  if (!_output_changed) {
+    return false;
+  }
+  _output_changed = false;
+  *us = _output_change_us;
+  return true;
+}
+
+bool _Device::is_idle() {
+  std::lock_guard<std::mutex> lk(_m_idle);
+  return _idle_reads >= IDLE_READS;
+}
+
+uint32_t _Device::next_countdown() {
+  std::lock_guard<std::mutex> lk(_m_countdown);
+  int64_t next = 0;
+  for (int i = 0; i < NUM_PINS; i++) {
+    if (_pins[i]._countdown > 0 && (next == 0 || _pins[i]._countdown < next))
+      next = _pins[i]._countdown;
+  }
+  return next;
+}
+
 
 namespace _sim {
 
@@ -0,0 +1,113 @@
+/*
+  EdgeLog.cpp - Exactly timed output changes for the Arduino simulator
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "EdgeLog.h"
+
+#include <vector>
+#include "Device.h"
+#include "ultoa.h"
+
+namespace _sim {
+
+bool edge_logging = false;
+
+namespace {
+
+struct Edge {
+  uint64_t us;
+  uint32_t pwm_high_time;
+  uint32_t pwm_period;
+  uint8_t pin;
+  uint8_t state;
+};
+
+std::vector<Edge> edges;
+// What each pin last looked like, so that changes the client can't see
+// (e.g. the PWM period of a pin that isn't PWM) aren't logged. Pins start
+// as OUTPUT_LOW, as in Device.h.
+Edge last[NUM_PINS];
+
+void
+append_number(std::string* json, uint64_t value) {
+  char digits[FORMAT_BUFFER_SIZE];
+  json->append(digits, format_unsigned(value, digits, 10));
+}
+
+} // namespace
+
+void
+edge_log_start() {
+  edge_logging = true;
+  edges.reserve(EDGE_BATCH);
+}
+
+void
+edge_log_record(uint64_t us, int pin, int state, uint32_t pwm_high_time, uint32_t pwm_period) {
+  Edge edge;
+  edge.us = us;
+  edge.pin = pin;
+  edge.state = state;
+  // As in the snapshots, which only show PWM timing for PWM pins.
+  edge.pwm_high_time = (state == GPIO_PIN_OUTPUT_PWM) ? pwm_high_time : 0;
+  edge.pwm_period = (state == GPIO_PIN_OUTPUT_PWM) ? pwm_period : 0;
+  if (edge.state == last[pin].state && edge.pwm_high_time == last[pin].pwm_high_time &&
+      edge.pwm_period == last[pin].pwm_period) {
+    return;
+  }
+  last[pin] = edge;
+  // Several changes at once, e.g. tone() setting the period and then the
+  // high time, are one edge.
+  if (!edges.empty() && edges.back().pin == pin && edges.back().us == us) {
+    edges.back() = edge;
+    return;
+  }
+  edges.push_back(edge);
+  stat_add(_stats.edges);
+}
+
+size_t
+edge_log_size() {
+  return edges.size();
+}
+
+void
+edge_log_take(std::string* json) {
+  uint64_t prev_us = edges.empty() ? 0 : edges[0].us;
+  json->append("{ \"start_us\": ");
+  append_number(json, prev_us);
+  json->append(", \"edges\": [");
+  for (size_t i = 0; i < edges.size(); i++) {
+    const Edge& edge = edges[i];
+    json->append(i ? ", [" : "[");
+    append_number(json, edge.us - prev_us);
+    json->push_back(',');
+    append_number(json, edge.pin);
+    json->push_back(',');
+    append_number(json, edge.state);
+    if (edge.state == GPIO_PIN_OUTPUT_PWM) {
+      json->push_back(',');
+      append_number(json, edge.pwm_high_time);
+      json->push_back(',');
+      append_number(json, edge.pwm_period);
+    }
+    json->push_back(']');
+    prev_us = edge.us;
+  }
+  json->append("] }");
+  edges.clear();
+}
+
+}
@@ -0,0 +1,159 @@
+/*
+  Embed.cpp - C API for running the simulator inside another program
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "esplora_sim.h"
+
+#include <dlfcn.h>
+#include <string>
+#include "Device.h"
+#include "Embed.h"
+#include "global_variables.h"
+
+static_assert(SIM_PINS == NUM_PINS && SIM_MUX_CHANNELS == MUX_PINS, "esplora_sim.h has the Device's sizes");
+
+struct sim {
+  void* sketch;
+  std::string error;
+};
+
+namespace {
+
+// Whether there's a simulator, as there can only be one at a time.
+bool live = false;
+
+// A sketch's entry points, as C++ or, failing that, C functions.
+void (*sketch_function(void* sketch, const char* mangled, const char* name))() {
+  void* function = dlsym(sketch, mangled);
+  if (!function) {
+    function = dlsym(sketch, name);
+  }
+  return reinterpret_cast<void (*)()>(function);
+}
+
+} // namespace
+
+void*
+_sim::embed_load_sketch(const char* path, void (**setup)(), void (**loop)(), std::string* error) {
+  void* sketch = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+  if (!sketch) {
+    *error = dlerror();
+    return nullptr;
+  }
+  *setup = sketch_function(sketch, "_Z5setupv", "setup");
+  *loop = sketch_function(sketch, "_Z4loopv", "loop");
+  if (!*setup || !*loop) {
+    *error = "the sketch has no setup() and loop()";
+    dlclose(sketch);
+    return nullptr;
+  }
+  return sketch;
+}
+
+sim*
+sim_create(void) {
+  if (live) {
+    return nullptr;
+  }
+  live = true;
+  sim* s = new sim;
+  s->sketch = nullptr;
+  return s;
+}
+
+int
+sim_load_sketch(sim* s, const char* path) {
+  if (s->sketch) {
+    s->error = "a sketch is already loaded";
+    return -1;
+  }
+  void (*setup)();
+  void (*loop)();
+  void* sketch = _sim::embed_load_sketch(path, &setup, &loop, &s->error);
+  if (!sketch) {
+    return -1;
+  }
+  if (!_sim::embed_start(setup, loop)) {
+    s->error = "couldn't map a stack for the sketch";
+    dlclose(sketch);
+    return -1;
+  }
+  s->sketch = sketch;
+  return 0;
+}
+
+int
+sim_set_mux(sim* s, int channel, double voltage) {
+  if (channel < 0 || channel >= MUX_PINS) {
+    s->error = "no such mux channel";
+    return -1;
+  }
+  _sim::_device.set_mux_voltage(channel, voltage);
+  return 0;
+}
+
+int
+sim_set_pin(sim* s, int pin, int value) {
+  if (pin < 0 || pin >= NUM_PINS) {
+    s->error = "no such pin";
+    return -1;
+  }
+  _sim::_device.set_pin_voltage(pin, value == LOW ? 0 : 5);
+  return 0;
+}
+
+int
+sim_run_for(sim* s, uint64_t us) {
+  if (!s->sketch) {
+    s->error = "no sketch is loaded";
+    return -1;
+  }
+  _sim::embed_run_for(us);
+  return _sim::embed_finished() ? 1 : 0;
+}
+
+void
+sim_get_state(sim* s, sim_state* state) {
+  (void) s;
+  state->us = _sim::get_arduino_micros();
+  state->loops = _sim::embed_loops();
+  state->api_calls = _sim::embed_api_calls();
+  for (int i = 0; i < NUM_PINS; i++) {
+    state->pins[i] = _sim::_device.get_pin_state(i);
+    bool pwm = (state->pins[i] == GPIO_PIN_OUTPUT_PWM);
+    state->pwm_high_time[i] = pwm ? _sim::_device.get_pwm_high_time(i) : 0;
+    state->pwm_period[i] = pwm ? _sim::_device.get_pwm_period(i) : 0;
+  }
+  for (int i = 0; i < MUX_PINS; i++) {
+    state->mux[i] = _sim::_device.get_mux_voltage(i);
+  }
+  state->finished = _sim::embed_finished();
+}
+
+const char*
+sim_error(sim* s) {
+  return s->error.c_str();
+}
+
+void
+sim_destroy(sim* s) {
+  if (s->sketch) {
+    _sim::embed_stop();
+    dlclose(s->sketch);
+  }
+  _sim::embed_reset();
+  delete s;
+  live = false;
+}
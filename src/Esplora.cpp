@@ -58,17 +58,17 @@ _Esplora::_Esplora() {
 }
 
 int _Esplora::readSlider() {
-  _sim::increment_counter(1);
+  _sim::increment_counter(1, _sim::API_ESPLORA);
   return _sim::_device.get_mux_value(CH_SLIDER);
 }
 
 int _Esplora::readLightSensor() {
-  _sim::increment_counter(1);
+  _sim::increment_counter(1, _sim::API_ESPLORA);
   return _sim::_device.get_mux_value(CH_LIGHT);
 }
 
 int _Esplora::readTemperature(byte scale) {
-  _sim::increment_counter(1);
+  _sim::increment_counter(1, _sim::API_ESPLORA);
   uint32_t temp = _sim::_device.get_mux_value(CH_TEMPERATURE);
   if (scale == DEGREES_F) {
     return (int)((temp * 450) / 512) - 58;
@@ -78,22 +78,22 @@ int _Esplora::readTemperature(byte scale) {
 }
 
 int _Esplora::readMicrophone() {
-  _sim::increment_counter(1);
+  _sim::increment_counter(1, _sim::API_ESPLORA);
   return _sim::_device.get_mux_value(CH_MIC);
 }
 
 int _Esplora::readJoystickSwitch() {
-  _sim::increment_counter(5);
+  _sim::increment_counter(5, _sim::API_ESPLORA);
   return _sim::_device.get_mux_value(CH_JOYSTICK_SW);
 }
 
 int _Esplora::readJoystickButton() {
-  _sim::increment_counter(7);
+  _sim::increment_counter(7, _sim::API_ESPLORA);
   return (_sim::_device.get_mux_value(CH_JOYSTICK_SW) == 1023) ? HIGH : LOW;
 }
 
 int _Esplora::readAccelerometer(byte axis) {
-  _sim::increment_counter(1);
+  _sim::increment_counter(1, _sim::API_ESPLORA);
   switch (axis) {
     case X_AXIS: return analogRead(ACCEL_X_PIN) - 512;
     case Y_AXIS: return analogRead(ACCEL_Y_PIN) - 512;
@@ -103,13 +103,13 @@ int _Esplora::readAccelerometer(byte axis) {
 }
 
 bool _Esplora::joyLowHalf(byte joyCh) {
-  _sim::increment_counter(1);
+  _sim::increment_counter(1, _sim::API_ESPLORA);
   return (_sim::_device.get_mux_value(joyCh) < 512 - JOYSTICK_DEAD_ZONE)
          ? LOW : HIGH;
 }
 
 bool _Esplora::joyHighHalf(byte joyCh) {
-  _sim::increment_counter(1);
+  _sim::increment_counter(1, _sim::API_ESPLORA);
   return (_sim::_device.get_mux_value(joyCh) > 512 + JOYSTICK_DEAD_ZONE)
          ? LOW : HIGH;
 }
@@ -119,7 +119,7 @@ bool _Esplora::readButton(byte button) {
     button--;
   } else {
 
-    _sim::increment_counter(1);
+    _sim::increment_counter(1, _sim::API_ESPLORA);
     return HIGH;
   }
   switch (button) {
@@ -132,17 +132,17 @@ bool _Esplora::readButton(byte button) {
     case JOYSTICK_DOWN:
       return joyHighHalf(CH_JOYSTICK_Y);
   }
-  _sim::increment_counter(1);
+  _sim::increment_counter(1, _sim::API_ESPLORA);
   return (_sim::_device.get_mux_value(button) > 512) ? HIGH : LOW;
 }
 
 int _Esplora::readJoystickX() {
-  _sim::increment_counter(1);
+  _sim::increment_counter(1, _sim::API_ESPLORA);
   return _sim::_device.get_mux_value(CH_JOYSTICK_X) - 512;
 }
 
 int _Esplora::readJoystickY() {
-  _sim::increment_counter(1);
+  _sim::increment_counter(1, _sim::API_ESPLORA);
   return _sim::_device.get_mux_value(CH_JOYSTICK_Y) - 512;
 }
 
@@ -156,46 +156,46 @@ void _Esplora::writeRGB(byte red, byte green, byte blue) {
 // TODO: remove led update
 void _Esplora::writeRed(byte red) {
   if (red == lastRed) {
-    _sim::increment_counter(1);
+    _sim::increment_counter(1, _sim::API_ESPLORA);
     return;
   }
   lastRed = red;
   analogWrite(RED_PIN, red);
-  _sim::increment_counter(1);
+  _sim::increment_counter(1, _sim::API_ESPLORA);
 }
 
 void _Esplora::writeGreen(byte green) {
   if (green == lastGreen) {
-    _sim::increment_counter(1);
+    _sim::increment_counter(1, _sim::API_ESPLORA);
     return;
   }
   lastGreen = green;
   analogWrite(GREEN_PIN, green);
-  _sim::increment_counter(1);
+  _sim::increment_counter(1, _sim::API_ESPLORA);
 }
 
 void _Esplora::writeBlue(byte blue) {
   if (blue == lastBlue) {
-    _sim::increment_counter(1);
+    _sim::increment_counter(1, _sim::API_ESPLORA);
     return;
   }
   lastBlue = blue;
   analogWrite(BLUE_PIN, blue);
-  _sim::increment_counter(1);
+  _sim::increment_counter(1, _sim::API_ESPLORA);
 }
 
 byte _Esplora::readRed() {
-  _sim::increment_counter(1);
+  _sim::increment_counter(1, _sim::API_ESPLORA);
   return lastRed;
 }
 
 byte _Esplora::readGreen() {
-  _sim::increment_counter(1);
+  _sim::increment_counter(1, _sim::API_ESPLORA);
   return lastGreen;
 }
 
 byte _Esplora::readBlue() {
-  _sim::increment_counter(1);
+  _sim::increment_counter(1, _sim::API_ESPLORA);
   return lastBlue;
 }
 
@@ -221,18 +221,18 @@ void _Esplora::tone(unsigned int freq, unsigned long duration) {
 
 inline unsigned int readTinkerkitInput(byte whichInput) {
   if (whichInput < 2) {
-    _sim::increment_counter(1);
+    _sim::increment_counter(1, _sim::API_ESPLORA);
     return _sim::_device.get_mux_value(whichInput + CH_TINKERKIT_A);
   }
   return 0;
 }
 
 inline unsigned int readTinkerkitInputA() {
-  _sim::increment_counter(1);
+  _sim::increment_counter(1, _sim::API_ESPLORA);
   return _sim::_device.get_mux_value(CH_TINKERKIT_A);
 }
 
 inline unsigned int readTinkerkitInputB() {
-  _sim::increment_counter(1);
+  _sim::increment_counter(1, _sim::API_ESPLORA);
   return _sim::_device.get_mux_value(CH_TINKERKIT_B);
 }
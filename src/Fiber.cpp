@@ -0,0 +1,162 @@
+/*
+  Fiber.cpp - Stackful coroutines for running the sketch
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "Fiber.h"
+
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#ifdef ESPLORA_FIBER_ASM
+// A switched out context is its callee-saved registers pushed on its own
+// stack, below the address to return to, with MXCSR and the x87 control word
+// (which the ABI also has callees preserve) in the last 8 bytes. A new fiber
+// starts with the same frame, returning into esplora_fiber_start with
+// Fiber::run in r12 and the Fiber in r13.
+asm(".text\n"
+    ".globl esplora_fiber_switch\n"
+    ".hidden esplora_fiber_switch\n"
+    ".type esplora_fiber_switch, @function\n"
+    "esplora_fiber_switch:\n"
+    "  pushq %rbp\n"
+    "  pushq %rbx\n"
+    "  pushq %r12\n"
+    "  pushq %r13\n"
+    "  pushq %r14\n"
+    "  pushq %r15\n"
+    "  subq $8, %rsp\n"
+    "  stmxcsr (%rsp)\n"
+    "  fnstcw 4(%rsp)\n"
+    "  movq %rsp, (%rdi)\n"
+    "  movq %rsi, %rsp\n"
+    "  ldmxcsr (%rsp)\n"
+    "  fldcw 4(%rsp)\n"
+    "  addq $8, %rsp\n"
+    "  popq %r15\n"
+    "  popq %r14\n"
+    "  popq %r13\n"
+    "  popq %r12\n"
+    "  popq %rbx\n"
+    "  popq %rbp\n"
+    "  ret\n"
+    ".size esplora_fiber_switch, .-esplora_fiber_switch\n"
+    "\n"
+    ".type esplora_fiber_start, @function\n"
+    "esplora_fiber_start:\n"
+    "  .cfi_startproc\n"
+    // The bottom of the fiber's stack, as far as unwinders are concerned.
+    "  .cfi_undefined rip\n"
+    "  movq %r13, %rdi\n"
+    "  callq *%r12\n"
+    "  ud2\n"
+    "  .cfi_endproc\n"
+    ".size esplora_fiber_start, .-esplora_fiber_start\n");
+
+extern "C" void esplora_fiber_start();
+#endif
+
+namespace _sim {
+
+namespace {
+
+#ifdef ESPLORA_FIBER_ASM
+const uint32_t DEFAULT_MXCSR = 0x1f80;
+const uint16_t DEFAULT_FPU_CONTROL = 0x037f;
+#else
+// makecontext only passes ints, so the pointers come in halves.
+void
+start_context(uint32_t entry_high, uint32_t entry_low, uint32_t arg_high, uint32_t arg_low) {
+  void (*entry)(void*) = reinterpret_cast<void (*)(void*)>(static_cast<uintptr_t>(
+    static_cast<uint64_t>(entry_high) << 32 | entry_low));
+  entry(reinterpret_cast<void*>(static_cast<uintptr_t>(static_cast<uint64_t>(arg_high) << 32 | arg_low)));
+}
+#endif
+
+} // namespace
+
+Fiber::Fiber() : _entry(nullptr), _arg(nullptr), _finished(false), _stack(nullptr), _map_bytes(0) {
+#ifdef ESPLORA_FIBER_ASM
+  _sp = nullptr;
+  _caller_sp = nullptr;
+#endif
+}
+
+Fiber::~Fiber() {
+  free_stack();
+}
+
+void
+Fiber::run(void* fiber) {
+  Fiber* self = static_cast<Fiber*>(fiber);
+  self->_entry(self->_arg);
+  self->_finished = true;
+  // Never resumed again, as resume() frees the stack this is running on.
+  self->yield();
+}
+
+void
+Fiber::free_stack() {
+  if (_stack) {
+    munmap(_stack, _map_bytes);
+    _stack = nullptr;
+  }
+}
+
+bool
+Fiber::start(void (*entry)(void*), void* arg, size_t stack_bytes) {
+  free_stack();
+  _entry = entry;
+  _arg = arg;
+  _finished = false;
+  size_t page = sysconf(_SC_PAGESIZE);
+  stack_bytes = (stack_bytes + page - 1) & ~(page - 1);
+  _map_bytes = stack_bytes + page;
+  void* map = mmap(nullptr, _map_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+  if (map == MAP_FAILED) {
+    return false;
+  }
+  _stack = static_cast<char*>(map);
+  // Overflowing the stack faults on the guard page rather than scribbling on
+  // whatever is mapped below it.
+  mprotect(_stack, page, PROT_NONE);
+
+#ifdef ESPLORA_FIBER_ASM
+  // The frame esplora_fiber_switch pops, ending at the top of the stack so
+  // that esplora_fiber_start starts with it 16 byte aligned.
+  uint64_t* frame = reinterpret_cast<uint64_t*>(_stack + _map_bytes) - 8;
+  frame[0] = DEFAULT_MXCSR | static_cast<uint64_t>(DEFAULT_FPU_CONTROL) << 32;
+  frame[1] = 0;                                       // r15
+  frame[2] = 0;                                       // r14
+  frame[3] = reinterpret_cast<uintptr_t>(this);       // r13
+  frame[4] = reinterpret_cast<uintptr_t>(run);        // r12
+  frame[5] = 0;                                       // rbx
+  frame[6] = 0;                                       // rbp
+  frame[7] = reinterpret_cast<uintptr_t>(esplora_fiber_start);
+  _sp = frame;
+#else
+  getcontext(&_context);
+  _context.uc_stack.ss_sp = _stack + page;
+  _context.uc_stack.ss_size = stack_bytes;
+  _context.uc_link = nullptr;
+  uint64_t e = reinterpret_cast<uintptr_t>(run);
+  uint64_t a = reinterpret_cast<uintptr_t>(this);
+  makecontext(&_context, reinterpret_cast<void (*)()>(start_context), 4, static_cast<uint32_t>(e >> 32),
+              static_cast<uint32_t>(e), static_cast<uint32_t>(a >> 32), static_cast<uint32_t>(a));
+#endif
+  return true;
+}
+
+}
@@ -24,6 +24,7 @@
 #include <string.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <poll.h>
 #include <sys/epoll.h>
 #include <sys/inotify.h>
 #include <sys/timerfd.h>
@@ -37,10 +38,23 @@
 #include <cstdarg>
 #include <string>
 #include <array>
+#include <vector>
 #include <algorithm>
+#include <new>
 #include "Arduino.h"
 #include "Device.h"
+#include "Embed.h"
+#include "Fiber.h"
 #include "Serial.h"
+#include "Budget.h"
+#include "Clock.h"
+#include "EdgeLog.h"
+#include "Profile.h"
+#include "Stats.h"
+#include "Timeline.h"
+#include "Trace.h"
+#include "UpdateSinks.h"
+#include "Zygote.h"
 
 #include "global_variables.h"
 
@@ -60,6 +74,10 @@ _Esplora Esplora;
 
 // namespace _sim so the arduino code can't call
 // all the functions the simulator uses easily
+// Weak, so that the library links without a sketch, see Embed.h.
+void setup() __attribute__((weak));
+void loop() __attribute__((weak));
+
 namespace _sim {
 
 _Device _device;
@@ -73,6 +91,9 @@ namespace {
 const int32_t HEARTBEAT_US = 60000;
 const int32_t MAX_SLEEP = 20000;
 const int32_t UPDATE_US = 20000;
+// In real-time mode, how often (in Arduino time) to resynchronise with the
+// wall clock. Outputs are never more than this far ahead of real time.
+const int32_t SYNC_SLACK_US = 1000;
 
 // tells the code thread to shutdown, suspend or operate in fast_mode
 std::atomic<bool> shutdown(false);
@@ -81,6 +102,51 @@ std::atomic<bool> fast_mode(false);
 
 std::atomic<bool> heartbeat_mode(false);
 
+// fast-forward virtual time while the sketch is provably idle
+std::atomic<bool> idle_skip_mode(false);
+
+// Lockstep mode: Arduino time only advances as far as the client's step
+// events allow, up to step_end_us. Implies fast mode.
+bool step_mode = false;
+uint64_t step_end_us = 0;
+// Whether a step has been reported yet, as none is due before the first.
+bool stepped = false;
+
+// The sketch runs on sketch_fiber, and yields to whoever resumed it whenever
+// it has to wait. In the binary, that's run_scheduler on the main stack,
+// which does the waiting. Embedded in another program (see Embed.h), it's the
+// program, between steps. finished is set once the sketch has ended.
+bool embedded = false;
+Fiber sketch_fiber;
+// As much as a thread would get, though only what's used is ever touched.
+const size_t SKETCH_STACK_BYTES = 8 << 20;
+bool finished = false;
+
+// What the sketch has yielded to the scheduler to wait for.
+enum SketchWait {
+  // A client event, e.g. to resume us or give the next step.
+  WAIT_CLIENT_EVENT,
+  // The wall clock to catch up with wait_arduino_us, in real-time mode.
+  WAIT_ARDUINO_TIME,
+  // Embedded, the program's next step.
+  WAIT_STEP,
+};
+SketchWait sketch_wait = WAIT_CLIENT_EVENT;
+uint64_t wait_arduino_us = 0;
+
+// Thrown by finish to unwind the sketch's stack, see run_sketch.
+struct SketchFinished {};
+
+// The sketch's entry points. The binary is linked with a sketch, while the
+// library is handed one by embed_start.
+void (*sketch_setup)() = setup;
+void (*sketch_loop)() = loop;
+
+// charge Arduino time to call stacks, see Profile.h
+bool profiling = false;
+// record a Chrome trace, see Trace.h
+bool tracing = false;
+
 // send updates back to the browser
 std::atomic<bool> send_updates(true);
 // run the student code
@@ -89,18 +155,87 @@ std::atomic<bool> running(true);
 // File descriptor to write ___device_updates.
 int updates_fd = -1;
 int client_fd = -1;
+// inotify fd watching ___client_events, when it's a file rather than a pipe
+int client_notify_fd = -1;
+
+// How many Arduino microseconds pass per real microsecond in real-time mode.
+std::atomic<double> speed(1.0);
+
+// Real-time pacing is anchored at a (monotonic clock, wall time) pair, and
+// re-anchored whenever the speed changes so that wall time stays continuous.
+uint64_t wall_base_real_us = 0;
+uint64_t wall_base_us = 0;
+// Monotonic clock reading when wall time was first read.
+uint64_t real_start_us = 0;
+// Arduino time at which sleep_and_update next checks the wall clock.
+uint64_t next_sync_us = 0;
 
 // current loop number
 std::atomic<uint32_t> current_loop(0);
 
-// Write to the output pipe
-// Add a 5 us delay to stop data corruption from spamming the command line gui
+// Stop the run after this much Arduino time, this many loop() iterations or
+// this many calls the sketch makes to the API (to increment_counter, rather
+// than the time the simulator charges for setup and each loop). Zero means no
+// limit.
+uint64_t stop_after_us = 0;
+uint64_t stop_after_loops = 0;
+uint64_t stop_after_calls = 0;
+uint64_t api_calls = 0;
+
+// Arduino time of the last pin update and of the last client event poll
+uint64_t last_update_us = 0;
+// How often to sample pin state, i.e. UPDATE_US unless a sink wants it more
+// often.
+uint64_t update_period_us = UPDATE_US;
+uint64_t last_heartbeat_us = 0;
+
+// The input event whose reaction is being timed, if any: its type, pin and
+// the Arduino time it was applied.
+bool reaction_pending = false;
+const char* reaction_input = nullptr;
+int reaction_pin = 0;
+uint64_t reaction_input_us = 0;
+
+// Arduino time at which the last loop() started.
+uint64_t loop_start_us = 0;
+
+// Write a sim_stats update every this many real microseconds, zero for never.
+uint64_t stats_period_us = 0;
+uint64_t next_stats_real_us = 0;
+
+// From the sketch: yield to the scheduler until what it's waiting for has
+// happened.
+void
+wait_in_scheduler(SketchWait wait, uint64_t arduino_us = 0) {
+  sketch_wait = wait;
+  wait_arduino_us = arduino_us;
+  sketch_fiber.yield();
+}
+
+// How far Arduino time is behind the wall clock in real-time mode.
+int64_t
+current_lag_us() {
+  if (fast_mode) {
+    return 0;
+  }
+  return static_cast<int64_t>(wall_time_micros() - get_arduino_micros());
+}
+
+// Write to the sinks that want this type of update (see UpdateSinks.h),
+// queueing it for any whose consumer is behind. In fast mode, should_suspend
+// waits for the primary sink's client to resume us, if it was sent there.
+// Lockstep mode waits for steps instead.
 void
-write_to_updates(const void* buf, size_t count, bool should_suspend = false) {
-  if (should_suspend) {
+write_to_updates(const void* buf, size_t count, bool should_suspend, UpdateType type, SinkSet sinks = ALL_SINKS) {
+  stat_add(_stats.updates);
+  stat_add(_stats.update_bytes, count);
+  if (tracing) {
+    trace_instant(TRACE_UPDATE, count);
+  }
+  SinkSet written = update_sinks_write(sinks, type, buf, count);
+  if (should_suspend && !step_mode && (written & PRIMARY_SINK)) {
     suspend = true;
   }
-  write(updates_fd, buf, count);
 }
 
 void
@@ -121,8 +256,9 @@ list_to_json(const char* field, char** json_ptr, char* json_end, int* values, si
   } else {
     appendf(json_ptr, json_end, "\"%s\": [", field);
 
-    for (size_t i = 0; i < len; ++i) {
-      appendf(json_ptr, json_end, "%d,", values[i]);
+    for (size_t i = 0; i < len && json_end - *json_ptr >= (ptrdiff_t) FORMAT_BUFFER_SIZE; ++i) {
+      *json_ptr += format_signed(values[i], *json_ptr, 10);
+      *(*json_ptr)++ = ',';
     }
 
     // Replace trailing comma with ']'.
@@ -130,12 +266,29 @@ list_to_json(const char* field, char** json_ptr, char* json_end, int* values, si
   }
 }
 
-void send_pin_update() {
-  static int prev_pins[NUM_PINS] = {0};
-  static int prev_pwm_high_time[NUM_PINS] = {0};
-  static int prev_pwm_period[NUM_PINS] = {0};
+// Send the output changes logged since the last batch, see EdgeLog.h.
+void
+write_edges() {
+  // Reused so that batches don't allocate once it has grown.
+  static std::string json;
+  char head[128];
+  snprintf(head, sizeof(head), "[{ \"type\": \"arduino_edges\", \"ticks\": %" PRIu64 ", \"data\": ",
+           get_elapsed_millis());
+  json.assign(head);
+  edge_log_take(&json);
+  json.append(" }]\n");
+  write_to_updates(json.data(), json.size(), false, UPDATE_EDGES);
+}
+
+// Send the pin state to the sinks that are due it, i.e. whose pins have
+// changed and whose period has passed (or regardless of period, if forced).
+void send_pin_update(bool force = false) {
   if (!send_updates)
     return;
+  // Edges first, as they led up to this state.
+  if (edge_log_size() > 0) {
+    write_edges();
+  }
   int pins[NUM_PINS];
   int pwm_high_time[NUM_PINS] = {0};
   int pwm_period[NUM_PINS] = {0};
@@ -147,10 +300,8 @@ void send_pin_update() {
     }
   }
 
-  if (memcmp(pins, prev_pins, sizeof(prev_pins)) != 0 ||
-      memcmp(pwm_period, prev_pwm_period, sizeof(prev_pwm_period)) != 0 ||
-      memcmp(pwm_high_time, prev_pwm_high_time, sizeof(prev_pwm_high_time)) != 0 ) {
-    // pin states have changed
+  SinkSet due = update_sinks_pins_due(pins, pwm_high_time, pwm_period, get_arduino_micros(), force);
+  if (due) {
     char json[1024];
     char* json_ptr = json;
     char* json_end = json + sizeof(json);
@@ -166,11 +317,7 @@ void send_pin_update() {
     list_to_json("pwmp", &json_ptr, json_end, pwm_period, sizeof(pwm_period) / sizeof(int));
     appendf(&json_ptr, json_end, "}}]\n");
 
-    write_to_updates(json, json_ptr - json, true);
-
-    memcpy(prev_pins, pins, sizeof(pins));
-    memcpy(prev_pwm_high_time, pwm_high_time, sizeof(pwm_high_time));
-    memcpy(prev_pwm_period, pwm_period, sizeof(pwm_period));
+    write_to_updates(json, json_ptr - json, true, UPDATE_PINS, due);
   }
 }
 
@@ -190,7 +337,7 @@ check_random_updates() {
             "[{ \"type\": \"random_state\", \"ticks\": %" PRIu64 ", \"data\": { \"exceeded\": %s }}]\n",
             get_elapsed_millis(), exceeded ? "true" : "false");
 
-    write_to_updates(json, json_ptr - json, true);
+    write_to_updates(json, json_ptr - json, true, UPDATE_RANDOM_STATE);
 
     exceeded_prev = exceeded;
   }
@@ -227,7 +374,7 @@ check_marker_failure_updates() {
     buffer_destroy(category_buf);
     buffer_destroy(message_buf);
 
-    write_to_updates(json, json_ptr - json, true);
+    write_to_updates(json, json_ptr - json, true, UPDATE_MARKER_FAILURE);
 
     set_marker_failure_event(nullptr, nullptr);
   }
@@ -242,11 +389,11 @@ write_heartbeat() {
   char* json_end = json + sizeof(json);
 
   appendf(&json_ptr, json_end,
-          "[{ \"type\": \"arduino_heartbeat\", \"ticks\": %" PRIu64 ", \"data\": { \"real_ticks\": \"%" PRIu64 "\" "
-          "}}]\n",
-          get_elapsed_millis(), wall_time_micros() / 1000);
+          "[{ \"type\": \"arduino_heartbeat\", \"ticks\": %" PRIu64 ", \"data\": { \"real_ticks\": \"%" PRIu64 "\", "
+          "\"speed\": %g }}]\n",
+          get_elapsed_millis(), real_time_micros() / 1000, static_cast<double>(speed));
 
-  write_to_updates(json, json_ptr - json, true);
+  write_to_updates(json, json_ptr - json, true, UPDATE_HEARTBEAT);
 
 }
 
@@ -260,22 +407,129 @@ write_hello() {
           "[{ \"type\": \"arduino_hello\", \"ticks\": %" PRIu64 ", \"data\": {}}]\n",
           get_elapsed_millis());
 
-  write_to_updates(json, json_ptr - json, false);
+  write_to_updates(json, json_ptr - json, false, UPDATE_HELLO);
+}
+
+void
+write_bye(const char* reason) {
+  char json[20480];
+  char* json_ptr = json;
+  char* json_end = json + sizeof(json);
+
+  appendf(&json_ptr, json_end,
+          "[{ \"type\": \"arduino_bye\", \"ticks\": %" PRIu64 ", \"data\": { \"real_ticks\": \"%" PRIu64 "\", "
+          "\"speed\": %g, \"api_calls\": %" PRIu64,
+          get_elapsed_millis(), real_time_micros() / 1000, static_cast<double>(speed), api_calls);
+  if (reason) {
+    appendf(&json_ptr, json_end, ", \"reason\": \"%s\"", reason);
+  }
+  char stats_json[16384];
+  stats_to_json(stats_json, sizeof(stats_json), current_lag_us());
+  appendf(&json_ptr, json_end, ", \"stats\": %s }}]\n", stats_json);
+
+  write_to_updates(json, json_ptr - json, false, UPDATE_BYE);
+}
+
+
+// Tell the client which budget this run has used up.
+void
+write_budget_exceeded(const char* budget, uint64_t limit, uint64_t used) {
+  char json[1024];
+  char* json_ptr = json;
+  char* json_end = json + sizeof(json);
+
+  appendf(&json_ptr, json_end,
+          "[{ \"type\": \"budget_exceeded\", \"ticks\": %" PRIu64 ", \"data\": { \"budget\": \"%s\", "
+          "\"limit_us\": %" PRIu64 ", \"used_us\": %" PRIu64 " }}]\n",
+          get_elapsed_millis(), budget, limit, used);
+
+  write_to_updates(json, json_ptr - json, false, UPDATE_BUDGET_EXCEEDED);
 }
 
+// Periodic snapshot of the simulator's counters, see Stats.h.
 void
-write_bye() {
+write_sim_stats() {
+  char stats_json[16384];
+  stats_to_json(stats_json, sizeof(stats_json), current_lag_us());
+
+  char json[20480];
+  char* json_ptr = json;
+  char* json_end = json + sizeof(json);
+
+  appendf(&json_ptr, json_end, "[{ \"type\": \"sim_stats\", \"ticks\": %" PRIu64 ", \"data\": %s }]\n",
+          get_elapsed_millis(), stats_json);
+
+  write_to_updates(json, json_ptr - json, false, UPDATE_SIM_STATS);
+}
+
+// Report how long the sketch took to react to an input.
+void
+write_reaction(uint64_t output_us) {
   char json[1024];
   char* json_ptr = json;
   char* json_end = json + sizeof(json);
 
   appendf(&json_ptr, json_end,
-          "[{ \"type\": \"arduino_bye\", \"ticks\": %" PRIu64 ", \"data\": { \"real_ticks\": \"%" PRIu64 "\" }}]\n",
-          get_elapsed_millis(), wall_time_micros() / 1000);
+          "[{ \"type\": \"arduino_reaction\", \"ticks\": %" PRIu64 ", \"data\": { \"input\": \"%s\", "
+          "\"pin\": %d, \"input_us\": %" PRIu64 ", \"output_us\": %" PRIu64 ", \"latency_us\": %" PRIu64 " }}]\n",
+          get_elapsed_millis(), reaction_input, reaction_pin, reaction_input_us, output_us,
+          output_us - reaction_input_us);
+
+  write_to_updates(json, json_ptr - json, false, UPDATE_REACTION);
+}
 
-  write_to_updates(json, json_ptr - json, false);
+// If an output has changed since the pending input was applied, record and
+// report the reaction time.
+void
+check_reaction() {
+  uint64_t output_us;
+  if (reaction_pending && _device.output_changed(&output_us)) {
+    reaction_pending = false;
+    stat_record(_stats.reaction_us, output_us - reaction_input_us);
+    write_reaction(output_us);
+  }
 }
 
+// Start timing the reaction to an input that has just been applied. A newer
+// input replaces one that hasn't had a reaction yet.
+void
+start_reaction(const char* input, int pin) {
+  check_reaction();
+  reaction_pending = true;
+  reaction_input = input;
+  reaction_pin = pin;
+  reaction_input_us = get_arduino_micros();
+  _device.watch_outputs();
+}
+
+// Say goodbye and end the sketch, unwinding its stack back to run_sketch.
+// Called once it has run, or from inside increment_counter when the run has
+// to stop immediately, in which case reason says why.
+void __attribute__((noreturn))
+finish(const char* reason) {
+  check_reaction();
+  if (edge_log_size() > 0) {
+    write_edges();
+  }
+  write_bye(reason);
+  if (profiling) {
+    profile_write();
+  }
+  if (tracing) {
+    trace_write();
+  }
+  timeline_close();
+
+  update_sinks_close();
+  if (!embedded) {
+    close(client_fd);
+    if (client_notify_fd != -1) {
+      close(client_notify_fd);
+    }
+  }
+  finished = true;
+  throw SketchFinished();
+}
 
 // Write ack to say we received the data.
 void
@@ -288,7 +542,22 @@ write_event_ack(const char* event_type, const char* ack_data_json) {
           "[{ \"type\": \"arduino_ack\", \"ticks\": %" PRIu64 ", \"data\": { \"type\": \"%s\", \"data\": "
           "%s }}]\n",
           get_elapsed_millis(), event_type, ack_data_json ? ack_data_json : "{}");
-  write_to_updates(json, json_ptr - json, false);
+  write_to_updates(json, json_ptr - json, false, UPDATE_ACK);
+}
+
+// Tell the client that a step has been run, once everything up to its end
+// has been sent.
+void
+write_step_done() {
+  char json[1024];
+  char* json_ptr = json;
+  char* json_end = json + sizeof(json);
+
+  appendf(&json_ptr, json_end,
+          "[{ \"type\": \"arduino_step_done\", \"ticks\": %" PRIu64 ", \"data\": { \"us\": %" PRIu64
+          ", \"api_calls\": %" PRIu64 " }}]\n",
+          get_elapsed_millis(), get_arduino_micros(), api_calls);
+  write_to_updates(json, json_ptr - json, false, UPDATE_STEP_DONE);
 }
 
 // process a multiplexer event - the pins are as follows:
@@ -318,6 +587,7 @@ process_client_mux(const json_value* data) {
   int pin_num = id->as.number;
   double v = voltage->as.number;
   _device.set_mux_voltage(pin_num, v);
+  start_reaction("arduino_mux", pin_num);
   char ack_json[1024];
   snprintf(ack_json, sizeof(ack_json), "{\"pin\": %d, \"v\": %.2f}", static_cast<int32_t>(pin_num), static_cast<double>(v));
   write_event_ack("arduino_mux", ack_json);
@@ -343,11 +613,60 @@ process_client_pins(const json_value* data) {
   int pin_num = id->as.number;
   int val = voltage->as.number;
   _device.set_pin_voltage(pin_num, val);
+  start_reaction("arduino_pin", pin_num);
   char ack_json[1024];
   snprintf(ack_json, sizeof(ack_json), "{\"pin\": %d, \"v\":%.2f}", static_cast<int32_t>(pin_num), static_cast<double>(val));
   write_event_ack("arduino_pin", ack_json);
 }
 
+// Change the real-time speed factor, e.g. 0.25 for a slow demo or 10 to run
+// ten times faster than real time.
+void
+process_client_speed(const json_value* data) {
+  const json_value* factor = json_value_get(data, "speed");
+  if (!factor || factor->type != JSON_VALUE_TYPE_NUMBER || !(factor->as.number > 0)) {
+    fprintf(stderr, "Speed event missing a positive speed\n");
+    return;
+  }
+  set_speed(factor->as.number);
+  char ack_json[1024];
+  snprintf(ack_json, sizeof(ack_json), "{\"speed\": %g}", factor->as.number);
+  write_event_ack("speed", ack_json);
+}
+
+// Let the sketch run us further than now, or than the end of the last step
+// if that's later, stopping at the end of time rather than wrapping round.
+void
+extend_step(uint64_t us) {
+  uint64_t from = max(step_end_us, get_arduino_micros());
+  step_end_us = from + min(us, UINT64_MAX - from);
+}
+
+// Let Arduino time run on by this many microseconds, in lockstep mode.
+void
+process_client_step(const json_value* data) {
+  const json_value* us = json_value_get(data, "us");
+  if (!us || us->type != JSON_VALUE_TYPE_NUMBER || !(us->as.number >= 0)) {
+    fprintf(stderr, "Step event missing a non-negative us\n");
+    return;
+  }
+  if (!step_mode) {
+    fprintf(stderr, "Step event outside lockstep mode\n");
+    return;
+  }
+  // Anything from 2^64 up, e.g. Infinity, can't be converted, and is as good
+  // as forever anyway.
+  uint64_t step_us = us->as.number < static_cast<double>(UINT64_MAX) ? us->as.number : UINT64_MAX;
+  if (step_us == 0) {
+    // Nothing to run, as steps are only read while the last one is done, but
+    // the client still waits to hear that it has been.
+    force_pin_update();
+    write_step_done();
+    return;
+  }
+  extend_step(step_us);
+}
+
 // void
 // process_client_random(const json_value* data) {
 //   const json_value* next = json_value_get(data, "next");
@@ -375,11 +694,13 @@ void
 process_client_json(const json_value* json) {
   if (json->type != JSON_VALUE_TYPE_ARRAY) {
     fprintf(stderr, "Client event JSON wasn't a list.\n");
+    stat_add(_stats.events_rejected);
   }
   const json_value_list* event = json->as.pairs;
   while (event) {
     if (event->value->type != JSON_VALUE_TYPE_OBJECT) {
       fprintf(stderr, "Event should be an object.\n");
+      stat_add(_stats.events_rejected);
       event = event->next;
       continue;
     }
@@ -388,7 +709,9 @@ process_client_json(const json_value* json) {
     if (!event_type || !event_data || event_type->type != JSON_VALUE_TYPE_STRING ||
         event_data->type != JSON_VALUE_TYPE_OBJECT) {
       fprintf(stderr, "Event missing type and/or data.\n");
+      stat_add(_stats.events_rejected);
     } else {
+      stat_add(_stats.events);
       if (strncmp(event_type->as.string, "resume", 6) == 0) {
         suspend = false;
       } else if (strncmp(event_type->as.string, "suspend", 7) == 0) {
@@ -399,6 +722,10 @@ process_client_json(const json_value* json) {
       } else if (strncmp(event_type->as.string, "arduino_mux", 11) == 0) {
         // Something driving the GPIO pins.
         process_client_mux(event_data);
+      } else if (strncmp(event_type->as.string, "speed", 6) == 0) {
+        process_client_speed(event_data);
+      } else if (strncmp(event_type->as.string, "step", 5) == 0) {
+        process_client_step(event_data);
       } else {
         fprintf(stderr, "Unknown event type: %s\n", event_type->as.string);
       }
@@ -417,6 +744,9 @@ process_client_event(int fd) {
   if (len == -1) {
     return;
   }
+  if (tracing && len > 0) {
+    trace_instant(TRACE_CLIENT_EVENT, len);
+  }
   if (len == sizeof(buf)) {
     fprintf(stderr, "Too much data in client event.\n");
     return;
@@ -433,6 +763,7 @@ process_client_event(int fd) {
       json_value_destroy(json);
     } else {
       fprintf(stderr, "Invalid JSON\n");
+      stat_add(_stats.events_rejected);
     }
 
     if (!*line_end) {
@@ -445,27 +776,129 @@ process_client_event(int fd) {
 // Setup the output pipe
 void
 setup_output_pipe() {
-  // Open the events pipe.
+  // Open the events pipe, unless a zygote request brought one.
   char* updates_pipe_str = getenv("GROK_UPDATES_PIPE");
-  if (updates_pipe_str != NULL) {
+  if (updates_fd == -1 && updates_pipe_str != NULL) {
     updates_fd = atoi(updates_pipe_str);
-  } else {
+  } else if (updates_fd == -1) {
     updates_fd = open("___device_updates", O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR);
   }
+  update_sinks_open(updates_fd, UPDATE_US);
+  update_period_us = update_sinks_period_us();
 }
 
 
+// Block until the client has sent something (or we're asked to shut down).
+// Pipes can be polled directly. The ___client_events file is always readable,
+// so instead we wait for inotify to report that it has been appended to.
+// Queued updates are written as the consumer makes room for them meanwhile,
+// since the client may be waiting for one of them before it resumes us.
+void
+wait_for_client_event() {
+  struct pollfd pfds[1 + MAX_SINKS];
+  struct pollfd& pfd = pfds[0];
+  pfd.fd = (client_notify_fd != -1) ? client_notify_fd : client_fd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+
+  // SIGINT stays blocked between checking the shutdown flag and sleeping, so
+  // the signal can't slip in between and leave us waiting forever.
+  sigset_t block, orig;
+  sigemptyset(&block);
+  sigaddset(&block, SIGINT);
+  sigprocmask(SIG_BLOCK, &block, &orig);
+  int n = 0;
+  while (!shutdown) {
+    n = ppoll(pfds, 1 + update_sinks_poll_fds(pfds + 1), NULL, &orig);
+    if (n <= 0 || pfd.revents) {
+      break;
+    }
+    update_sinks_flush();
+  }
+  sigprocmask(SIG_SETMASK, &orig, NULL);
+
+  if (n <= 0 || !pfd.revents) {
+    return;
+  }
+  if (client_notify_fd != -1) {
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (read(client_notify_fd, events, sizeof(events)) > 0) {
+    }
+  } else if ((pfd.revents & (POLLHUP | POLLIN)) == POLLHUP) {
+    // The client has gone away, so nothing can ever resume us.
+    fprintf(stderr, "Client pipe closed while suspended.\n");
+    shutdown = true;
+    running = false;
+  }
+}
+
 // check the suspend flag, if suspend is false, then continue
-// otherwise wait for the condition variable, cv_suspend
+// otherwise block until the client sends an event that resumes us
 void
 check_suspend() {
   if (!fast_mode) {
     return;
   }
+  if (!suspend || shutdown) {
+    return;
+  }
+  uint64_t start_us = monotonic_micros();
+  if (tracing) {
+    trace_begin(TRACE_SUSPEND);
+  }
   while (suspend && !shutdown) {
+    wait_in_scheduler(WAIT_CLIENT_EVENT);
     process_client_event(client_fd);
-    std::this_thread::sleep_for(std::chrono::microseconds(1000));
   }
+  if (tracing) {
+    trace_end(TRACE_SUSPEND);
+  }
+  stat_add(_stats.suspend_us, monotonic_micros() - start_us);
+}
+
+// Yield to the program we're embedded in until embed_run_for gives us
+// another step. If the sketch is being stopped instead, that happens here and
+// now.
+void
+park_for_step() {
+  while (get_arduino_micros() >= step_end_us && !shutdown) {
+    wait_in_scheduler(WAIT_STEP);
+  }
+  if (shutdown) {
+    finish(nullptr);
+  }
+}
+
+// In lockstep mode, how much of us Arduino time may run now. Once the last
+// step has been run, its end state is reported and we wait for the client's
+// next step, applying any other events it sends meanwhile. The report waits
+// until the sketch tries to go past the end of the step, so that it includes
+// everything the sketch did at that moment.
+int
+step_budget(int us) {
+  if (get_arduino_micros() >= step_end_us && !shutdown) {
+    if (stepped) {
+      force_pin_update();
+      write_step_done();
+    }
+    stepped = true;
+    uint64_t start_us = monotonic_micros();
+    if (tracing) {
+      trace_begin(TRACE_SUSPEND);
+    }
+    if (embedded) {
+      park_for_step();
+    }
+    while (get_arduino_micros() >= step_end_us && !shutdown) {
+      wait_in_scheduler(WAIT_CLIENT_EVENT);
+      process_client_event(client_fd);
+    }
+    if (tracing) {
+      trace_end(TRACE_SUSPEND);
+    }
+    stat_add(_stats.suspend_us, monotonic_micros() - start_us);
+  }
+  return min<uint64_t>(us, step_end_us - min(step_end_us, get_arduino_micros()));
 }
 
 // If we receive a shutdown signla
@@ -484,47 +917,108 @@ check_shutdown() {
 // updates checks if we need to update the device yet, and writes heartbeats for the marker
 void
 arduino_check_for_changes() {
-  static uint32_t last_update_us = 0;
-  static uint64_t last_heartbeat = 0;
   uint64_t curr_micros = get_arduino_micros();
 
-  if (curr_micros > last_update_us + UPDATE_US) {
+  if (edge_logging && edge_log_size() >= EDGE_BATCH) {
+    write_edges();
+  }
+
+  if (curr_micros > last_update_us + update_period_us) {
+    update_sinks_flush();
     send_pin_update();
     check_random_updates();
     check_marker_failure_updates();
+    check_reaction();
     last_update_us = curr_micros;
+
+    if (stats_period_us != 0) {
+      uint64_t real_us = monotonic_micros();
+      if (real_us >= next_stats_real_us) {
+        write_sim_stats();
+        next_stats_real_us = real_us + stats_period_us;
+      }
+    }
+
+    uint64_t limit, used;
+    const char* budget = budget_check(curr_micros, &limit, &used);
+    if (budget) {
+      write_budget_exceeded(budget, limit, used);
+      finish("budget_exceeded");
+    }
   }
 
   // Periodically heartbeat if the '-t' flag is enabled.
   // This is useful for the marker to ensure that it sees an event at least every N ticks.
-  if ((curr_micros > (last_heartbeat + HEARTBEAT_US))) {
-    process_client_event(client_fd);
-    last_heartbeat = curr_micros;
+  // Lockstep mode only reads client events between steps.
+  if ((curr_micros > (last_heartbeat_us + HEARTBEAT_US))) {
+    if (!step_mode) {
+      process_client_event(client_fd);
+    }
+    last_heartbeat_us = curr_micros;
     if (heartbeat_mode) {
       write_heartbeat();
     }
   }
 }
 
+// Sleep until the wall clock reaches the given Arduino time. The deadline is
+// absolute, so any oversleep is absorbed by the next deadline rather than
+// accumulating.
+void
+sleep_until_arduino_time(uint64_t arduino_time) {
+  uint64_t deadline = wall_base_real_us + (arduino_time - wall_base_us) / speed;
+  struct timespec t;
+  t.tv_sec = deadline / 1000000;
+  t.tv_nsec = (deadline % 1000000) * 1000;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) == EINTR && !shutdown) {
+  }
+}
+
 // Keeps track of the wall time so Arduino stays in sync in normal mode
 void sleep_and_update(uint32_t us) {
   _device.increment_counter(us);
-  uint64_t arduino_time = get_arduino_micros();
-  uint64_t wall_time = wall_time_micros();
-  if (!fast_mode) {
+  if (!fast_mode && get_arduino_micros() >= next_sync_us) {
+    uint64_t arduino_time = get_arduino_micros();
+    uint64_t wall_time = wall_time_micros();
     if (wall_time > arduino_time) {
       int32_t diff = wall_time - arduino_time;
+      stat_max(_stats.max_lag_us, diff);
+      if (tracing) {
+        trace_instant(TRACE_CATCH_UP, diff);
+      }
+      if (stop_after_us != 0 && arduino_time + diff > stop_after_us) {
+        diff = stop_after_us - arduino_time;
+      }
       _device.increment_counter(diff);
-    } else {
-      while (wall_time < arduino_time) {
-        std::this_thread::sleep_for(std::chrono::microseconds(5000));
-        wall_time = wall_time_micros();
+    } else if (wall_time < arduino_time) {
+      if (tracing) {
+        trace_begin(TRACE_SLEEP);
+      }
+      wait_in_scheduler(WAIT_ARDUINO_TIME, arduino_time);
+      if (tracing) {
+        trace_end(TRACE_SLEEP);
       }
     }
+    next_sync_us = get_arduino_micros() + SYNC_SLACK_US;
   }
   arduino_check_for_changes();
 }
 
+// How far an idle sketch can be fast-forwarded: client events are only read
+// on the heartbeat poll (or in lockstep mode, between steps), so no input can
+// change before then, and the only other scheduled event is a tone()
+// duration expiring.
+int
+idle_skip_us() {
+  uint64_t next_event_us = step_mode ? step_end_us : last_heartbeat_us + HEARTBEAT_US + 1;
+  int64_t until = static_cast<int64_t>(next_event_us) - get_arduino_micros();
+  uint32_t countdown = _device.next_countdown();
+  if (countdown > 0 && countdown < until) {
+    until = countdown;
+  }
+  return (until > 0) ? until : 0;
+}
+
 
 } // namespace
 
@@ -541,36 +1035,101 @@ get_arduino_micros() {
   return _device.get_micros();
 }
 
+// Wall clock time scaled by the speed factor, i.e. the Arduino time that
+// real-time mode should have reached by now.
 uint64_t
 wall_time_micros() {
-  static uint32_t starting_clock = 0;
+  uint64_t real_us_ticks = monotonic_micros();
 
-  struct timespec t;
-  clock_gettime(CLOCK_MONOTONIC_COARSE, &t);
+  if (real_start_us == 0) {
+    real_start_us = real_us_ticks;
+    wall_base_real_us = real_us_ticks;
+    wall_base_us = get_arduino_micros();
+  }
+  return wall_base_us + (real_us_ticks - wall_base_real_us) * speed;
+}
 
-  uint32_t real_us_ticks = (t.tv_sec * 1000000 + (t.tv_nsec / 1000));
+// Unscaled wall clock time since the simulator started.
+uint64_t
+real_time_micros() {
+  wall_time_micros();
+  return monotonic_micros() - real_start_us;
+}
 
-  if (starting_clock == 0) {
-    starting_clock = real_us_ticks - get_arduino_micros();
-  }
-  return real_us_ticks - starting_clock;
+// Change the real-time speed factor, re-anchoring the pacing so that wall
+// time carries on from where it was.
+void
+set_speed(double factor) {
+  wall_time_micros();
+  uint64_t real_us_ticks = monotonic_micros();
+  wall_base_us += (real_us_ticks - wall_base_real_us) * speed;
+  wall_base_real_us = real_us_ticks;
+  speed = factor;
+  next_sync_us = 0;
 }
 
 void force_pin_update() {
-  send_pin_update();
+  send_pin_update(true);
 }
 
-// Increment "arduino time" by the specified micros.
-// This is called all through Arduino.cpp/Esplora.cpp/Print.cpp to simulate operations taking time.
+// Stop at a precise point, e.g. after exactly stop_after_us of Arduino time,
+// flushing the final pin state before saying goodbye.
+void __attribute__((noreturn))
+stop_run(const char* reason) {
+  force_pin_update();
+  finish(reason);
+}
+
+// Let us of Arduino time pass, whether the sketch charged it, by way of the
+// API function that api returns into, or the simulator itself, with none.
 void
-increment_counter(int us) {
+pass_time(int us, void* api = nullptr) {
+  if (idle_skip_mode && _device.is_idle()) {
+    us = max(us, idle_skip_us());
+  }
+  bool reaches_limit = false;
+  if (stop_after_us != 0 && get_arduino_micros() + us >= stop_after_us) {
+    us = stop_after_us - min(stop_after_us, get_arduino_micros());
+    reaches_limit = true;
+  }
+  if (profiling) {
+    profile_charge(us, api);
+  }
   while (us > 0 && !shutdown) {
     check_suspend();
     check_shutdown();
     int d = min(MAX_SLEEP, us);
+    if (step_mode) {
+      d = step_budget(d);
+      if (d == 0) {
+        continue;
+      }
+    }
+    stat_add(_stats.steps);
     sleep_and_update(d);
     us -= d;
   }
+  if (reaches_limit && !shutdown) {
+    stop_run("time_limit");
+  }
+}
+
+// Increment "arduino time" by the specified micros.
+// This is called all through Arduino.cpp/Esplora.cpp/Print.cpp to simulate operations taking time.
+void
+increment_counter(int us, ApiKind kind) {
+  if (tracing) {
+    trace_begin(TRACE_API, __builtin_return_address(0), us);
+  }
+  if (stop_after_calls != 0 && api_calls >= stop_after_calls && !shutdown) {
+    stop_run("call_limit");
+  }
+  api_calls++;
+  stat_add(_stats.api_calls[kind]);
+  pass_time(us, __builtin_return_address(0));
+  if (tracing) {
+    trace_end(TRACE_API);
+  }
 }
 
 } // namespace _sim
@@ -580,14 +1139,34 @@ namespace {
 // Run the Arduino code
 void
 run_code() {
-  _sim::increment_counter(1032); // takes 1032 us for setup to run
-  setup();
+  if (_sim::tracing) {
+    _sim::trace_begin(_sim::TRACE_SETUP);
+  }
+  _sim::pass_time(1032); // takes 1032 us for setup to run
+  _sim::sketch_setup();
+  if (_sim::tracing) {
+    _sim::trace_end(_sim::TRACE_SETUP);
+  }
   while (_sim::running) {
     _sim::current_loop++;
-    loop();
+    uint64_t now_us = _sim::get_arduino_micros();
+    if (_sim::current_loop > 1) {
+      _sim::stat_record(_sim::_stats.loop_period_us, now_us - _sim::loop_start_us);
+    }
+    _sim::loop_start_us = now_us;
+    if (_sim::tracing) {
+      _sim::trace_begin(_sim::TRACE_LOOP, nullptr, _sim::current_loop);
+    }
+    _sim::sketch_loop();
+    if (_sim::tracing) {
+      _sim::trace_end(_sim::TRACE_LOOP);
+    }
+    if (_sim::stop_after_loops != 0 && _sim::current_loop >= _sim::stop_after_loops && !_sim::shutdown) {
+      _sim::stop_run("loop_limit");
+    }
     _sim::check_suspend();
     _sim::check_shutdown();
-    _sim::increment_counter(1);
+    _sim::pass_time(1);
   }
 }
 
@@ -599,37 +1178,125 @@ sig_handler(int s __attribute__((unused))) {
   _sim::running = false;
 }
 
+uint64_t
+limit_from_env(const char* name) {
+  const char* value = getenv(name);
+  return value ? strtoull(value, NULL, 10) : 0;
+}
+
 void show_help(char *s) {
   std::cout << "Usage:   " << s << " [-option] " << std::endl;
   std::cout << "option:  " << "-h  show help information" << std::endl;
-  std::cout << "         " << "-d  debug mode" << std::endl;
+  std::cout << "         " << "-a  stop after this many API calls ($GROK_STOP_AFTER_CALLS)" << std::endl;
+  std::cout << "         " << "-b  virtual time budget in ms" << std::endl;
+  std::cout << "         " << "-c  CPU time budget in ms" << std::endl;
+  std::cout << "         " << "-d  debug mode: write a Chrome trace to $GROK_TRACE_FILE (default ___trace.json)" << std::endl;
+  std::cout << "         " << "-e  report every output change with its exact time in arduino_edges updates" << std::endl;
   std::cout << "         " << "-f  fast mode" << std::endl;
+  std::cout << "         " << "-k  lockstep mode: only run as far as the client's step events say" << std::endl;
+  std::cout << "         " << "-l  stop after this many ms of Arduino time ($GROK_STOP_AFTER_MS)" << std::endl;
+  std::cout << "         " << "-n  stop after this many loop() iterations ($GROK_STOP_AFTER_LOOPS)" << std::endl;
+  std::cout << "         " << "-P  profile Arduino time by call stack into <prefix>.flat and <prefix>.folded" << std::endl;
+  std::cout << "         " << "-r  record pin and mux history to a timeline file, see build/timeline" << std::endl;
+  std::cout << "         " << "-s  write simulator stats every this many ms of real time" << std::endl;
   std::cout << "         " << "-t  hearbeat mode" << std::endl;
+  std::cout << "         " << "-u  maximum share of a CPU core to use, e.g. -u 0.5" << std::endl;
   std::cout << "         " << "-v  show version infomation" << std::endl;
+  std::cout << "         " << "-w  fast-forward while the sketch is idle" << std::endl;
+  std::cout << "         " << "-x  real-time speed factor, e.g. -x 0.25 or -x 10" << std::endl;
+  std::cout << "         " << "-z  serve runs to clients of this Unix socket from pre-forked children" << std::endl;
   exit(0);
 }
 
-} // namespace
+// Listen for runs on this socket rather than run one, see Zygote.h.
+const char* zygote_path = nullptr;
 
-int
-main(int argc, char** argv) {
-  // get command line options
+const char* const OPTIONS = "a:b:c:hdefkl:n:P:r:s:tu:vwx:z:";
+
+// Apply the command line options, or for a zygote run, the request's.
+void
+parse_options(int argc, char** argv) {
   char tmp;
-  bool debug = false;
-  while ((tmp = getopt(argc, argv, "hdftv")) != -1) {
+  while ((tmp = getopt(argc, argv, OPTIONS)) != -1) {
     switch (tmp) {
       case 'h':
         show_help(argv[0]);
         break;
+      case 'a':
+        _sim::stop_after_calls = strtoull(optarg, NULL, 10);
+        break;
+      case 'b':
+        _sim::budget_set_virtual_limit(strtoull(optarg, NULL, 10) * 1000);
+        break;
+      case 'c':
+        _sim::budget_set_cpu_limit(strtoull(optarg, NULL, 10) * 1000);
+        break;
       case 'd':
-        debug = true;
+        _sim::tracing = true;
+        _sim::trace_start(getenv("GROK_TRACE_FILE") ? getenv("GROK_TRACE_FILE") : "___trace.json");
+        break;
+      case 'e':
+        _sim::edge_log_start();
         break;
       case 'f':
         _sim::fast_mode = true;
         break;
+      case 'k':
+        _sim::step_mode = true;
+        _sim::fast_mode = true;
+        break;
+      case 'l':
+        _sim::stop_after_us = strtoull(optarg, NULL, 10) * 1000;
+        break;
+      case 'n':
+        _sim::stop_after_loops = strtoull(optarg, NULL, 10);
+        break;
+      case 'P':
+        _sim::profiling = true;
+        _sim::profile_start(optarg);
+        break;
+      case 'r':
+        if (!_sim::timeline_open(optarg)) {
+          std::cerr << "Couldn't write timeline to " << optarg << std::endl;
+          exit(EXIT_FAILURE);
+        }
+        // The mux channels' starting voltages, which the Device set before
+        // the timeline was open.
+        for (int channel = 0; channel < MUX_PINS; channel++) {
+          _sim::timeline_mux(0, channel, _sim::_device.get_mux_voltage(channel));
+        }
+        break;
+      case 's':
+        _sim::stats_period_us = strtoull(optarg, NULL, 10) * 1000;
+        break;
       case 't':
         _sim::heartbeat_mode = true;
         break;
+      case 'u': {
+        double share = strtod(optarg, NULL);
+        if (!(share > 0)) {
+          std::cerr << "CPU share must be positive" << std::endl;
+          exit(EXIT_FAILURE);
+        }
+        _sim::budget_set_cpu_share(share);
+        break;
+      }
+      case 'w':
+        _sim::idle_skip_mode = true;
+        _sim::_device.detect_idle();
+        break;
+      case 'x': {
+        double factor = strtod(optarg, NULL);
+        if (!(factor > 0)) {
+          std::cerr << "Speed factor must be positive" << std::endl;
+          exit(EXIT_FAILURE);
+        }
+        _sim::speed = factor;
+        break;
+      }
+      case 'z':
+        zygote_path = optarg;
+        break;
       case 'v':
         std::cout << "Arduino sim version is: 0.1" << std::endl;
         exit(0);
@@ -639,12 +1306,264 @@ main(int argc, char** argv) {
         break;
     }
   }
+}
+
+// Find -z, without applying any other option: a server leaves those to each
+// run. Anything that would exit, such as -h, is left to parse_options
+// without it. A server can't be given the options for a run's own output,
+// such as -r, as every run would write it to the same place.
+const char*
+find_zygote_path(int argc, char** argv) {
+  const char* path = nullptr;
+  char per_run = 0;
+  char tmp;
+  opterr = 0;
+  while ((tmp = getopt(argc, argv, OPTIONS)) != -1) {
+    if (tmp == 'z') {
+      path = optarg;
+    } else if (tmp == 'd' || tmp == 'e' || tmp == 'P' || tmp == 'r') {
+      per_run = tmp;
+    } else if (tmp == 'h' || tmp == 'v' || tmp == '?') {
+      path = nullptr;
+      break;
+    }
+  }
+  opterr = 1;
+  optind = 1;
+  if (path && per_run) {
+    std::cerr << "-" << per_run << " is given in each request to a zygote, not to the server" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  return path;
+}
+
+// The first option a request can't give, as it would exit or serve rather
+// than run, or '?' with optopt set for one that isn't valid, or 0 if there's
+// none.
+char
+find_disallowed_option(int argc, char** argv) {
+  char tmp;
+  char found = 0;
+  opterr = 0;
+  while ((tmp = getopt(argc, argv, OPTIONS)) != -1) {
+    if (tmp == 'h' || tmp == 'v' || tmp == 'z' || tmp == '?') {
+      found = tmp;
+      break;
+    }
+  }
+  opterr = 1;
+  optind = 1;
+  return found;
+}
+
+// Wait to be handed a run by the zygote, then become it: load its sketch,
+// apply its options, or the server's if it has none, and take its pipes.
+// The request is replied to once the run has said hello.
+void
+take_zygote_run(int argc, char** argv, _sim::ZygoteRequest* request) {
+  // Bind every symbol up front, by starting over with LD_BIND_NOW, so that
+  // each run doesn't look up the same ones again as it first calls them.
+  if (!getenv("LD_BIND_NOW")) {
+    setenv("LD_BIND_NOW", "1", 1);
+    execv("/proc/self/exe", argv);
+  }
+  _sim::zygote_serve(zygote_path, request);
+  // Static initialisation already read the wall clock, but the run starts
+  // now, not when the server did.
+  _sim::real_start_us = 0;
+  if (!request->sketch.empty()) {
+    std::string error;
+    if (_sim::sketch_setup) {
+      _sim::zygote_reply(request, "this server has a sketch built in");
+      exit(EXIT_FAILURE);
+    }
+    if (!_sim::embed_load_sketch(request->sketch.c_str(), &_sim::sketch_setup, &_sim::sketch_loop, &error)) {
+      _sim::zygote_reply(request, error.c_str());
+      exit(EXIT_FAILURE);
+    }
+  } else if (!_sim::sketch_setup) {
+    _sim::zygote_reply(request, "no sketch given, and none built in");
+    exit(EXIT_FAILURE);
+  }
+
+  std::vector<char*> args;
+  args.push_back(argv[0]);
+  for (std::string& arg : request->args) {
+    args.push_back(&arg[0]);
+  }
+  args.push_back(nullptr);
+  char option = find_disallowed_option(args.size() - 1, args.data());
+  if (option) {
+    std::string error = option == '?' ? std::string("bad option -") + static_cast<char>(optopt) :
+                                        std::string("option -") + option + " can't be given in a request";
+    _sim::zygote_reply(request, error.c_str());
+    exit(EXIT_FAILURE);
+  }
+  if (request->args.empty()) {
+    parse_options(argc, argv);
+  } else {
+    parse_options(args.size() - 1, args.data());
+  }
+  zygote_path = nullptr;
+
+  _sim::client_fd = request->client_fd;
+  _sim::updates_fd = request->updates_fd;
+}
+
+} // namespace
+
+namespace _sim {
+
+namespace {
+
+// The sketch fiber's entry. finish throws to unwind the sketch, which only
+// ends here, so that the fiber can end too. Arduino sketches don't use
+// exceptions, so none of them catch it on the way.
+void
+run_sketch(void*) {
+  try {
+    run_code();
+    finish(nullptr);
+  } catch (const SketchFinished&) {
+  }
+}
+
+// The binary's scheduler: run the sketch on its fiber, doing whatever it
+// waits for here on the main stack, then exit once it has finished.
+void __attribute__((noreturn))
+run_scheduler() {
+  if (!sketch_fiber.start(run_sketch, nullptr, SKETCH_STACK_BYTES)) {
+    fprintf(stderr, "Couldn't map a stack for the sketch\n");
+    exit(EXIT_FAILURE);
+  }
+  for (;;) {
+    sketch_fiber.resume();
+    if (finished) {
+      exit(EXIT_SUCCESS);
+    }
+    switch (sketch_wait) {
+      case WAIT_CLIENT_EVENT:
+        wait_for_client_event();
+        break;
+      case WAIT_ARDUINO_TIME:
+        sleep_until_arduino_time(wait_arduino_us);
+        break;
+      case WAIT_STEP:
+        break;
+    }
+  }
+}
+
+} // namespace
+
+bool
+embed_start(void (*setup)(), void (*loop)()) {
+  embedded = true;
+  step_mode = true;
+  fast_mode = true;
+  sketch_setup = setup;
+  sketch_loop = loop;
+  if (!sketch_fiber.start(run_sketch, nullptr, SKETCH_STACK_BYTES)) {
+    return false;
+  }
+  sketch_fiber.resume();
+  return true;
+}
+
+void
+embed_run_for(uint64_t us) {
+  if (finished || us == 0) {
+    return;
+  }
+  extend_step(us);
+  sketch_fiber.resume();
+}
+
+bool
+embed_finished() {
+  return finished;
+}
+
+uint64_t
+embed_loops() {
+  return current_loop;
+}
+
+uint64_t
+embed_api_calls() {
+  return api_calls;
+}
+
+void
+embed_stop() {
+  shutdown = true;
+  running = false;
+  if (!finished) {
+    sketch_fiber.resume();
+  }
+}
+
+void
+embed_reset() {
+  shutdown = false;
+  suspend = false;
+  fast_mode = false;
+  send_updates = true;
+  running = true;
+  embedded = false;
+  step_mode = false;
+  step_end_us = 0;
+  stepped = false;
+  finished = false;
+  sketch_setup = setup;
+  sketch_loop = loop;
+  wall_base_real_us = 0;
+  wall_base_us = 0;
+  real_start_us = 0;
+  next_sync_us = 0;
+  current_loop = 0;
+  api_calls = 0;
+  last_update_us = 0;
+  last_heartbeat_us = 0;
+  reaction_pending = false;
+  loop_start_us = 0;
+  string_pool_clear();
+  _stats = Stats();
+  // As when the library was loaded: the Esplora is zeroed and constructed,
+  // and then the Device, which is defined after it, over what its
+  // constructor set up.
+  memset(static_cast<void*>(&::Esplora), 0, sizeof(::Esplora));
+  new (&::Esplora) _Esplora();
+  _device.reset();
+  // As rand() is seeded before any srand().
+  srand(1);
+}
+
+} // namespace _sim
+
+int
+main(int argc, char** argv) {
+  // stop limits can also come from the environment, e.g. from a test harness
+  _sim::stop_after_us = limit_from_env("GROK_STOP_AFTER_MS") * 1000;
+  _sim::stop_after_loops = limit_from_env("GROK_STOP_AFTER_LOOPS");
+  _sim::stop_after_calls = limit_from_env("GROK_STOP_AFTER_CALLS");
+
+  _sim::ZygoteRequest request;
+  zygote_path = find_zygote_path(argc, argv);
+  if (zygote_path) {
+    take_zygote_run(argc, argv, &request);
+  } else {
+    parse_options(argc, argv);
+  }
 
   // setup updates_fd
   _sim::setup_output_pipe();
 
   // Let the UI know that the simulator has started (and compilation has finished).
   _sim::write_hello();
+  if (request.conn != -1) {
+    _sim::zygote_reply(&request, nullptr);
+  }
 
   if (_sim::heartbeat_mode) {
     _sim::write_heartbeat();
@@ -661,22 +1580,23 @@ main(int argc, char** argv) {
   // Set non-blocking stdin.
   fcntl(STDIN_FILENO, F_SETFL, fcntl(STDIN_FILENO, F_GETFL, 0) | O_NONBLOCK);
 
-  // Open the events pipe.
+  // Open the events pipe, unless a zygote request brought one.
   char* client_pipe_str = getenv("GROK_CLIENT_PIPE");
-  if (client_pipe_str != NULL) {
+  if (_sim::client_fd == -1 && client_pipe_str != NULL) {
     _sim::client_fd = atoi(client_pipe_str);
+  }
+  if (_sim::client_fd != -1) {
     fcntl(_sim::client_fd, F_SETFL, fcntl(_sim::client_fd, F_GETFL, 0) | O_NONBLOCK);
   } else {
     // Create and truncate the client events file.
     _sim::client_fd = open("___client_events", O_CREAT | O_TRUNC | O_RDONLY, S_IRUSR | S_IWUSR);
+    _sim::client_notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (_sim::client_notify_fd != -1 &&
+        inotify_add_watch(_sim::client_notify_fd, "___client_events", IN_MODIFY) == -1) {
+      close(_sim::client_notify_fd);
+      _sim::client_notify_fd = -1;
+    }
   }
 
-  run_code();
-
-  _sim::write_bye();
-
-  close(_sim::client_fd);
-  close(_sim::updates_fd);
-
-  return EXIT_SUCCESS;
+  _sim::run_scheduler();
 }
@@ -40,7 +40,7 @@ void Print::write(const char *str) {
   while (*str) {
     if (*str != '\r') {
       std::putchar(*str++);
-      _sim::increment_counter(8 + rand() % 5);
+      _sim::increment_counter(8 + rand() % 5, _sim::API_SERIAL);
     } else {
       str++;
     }
@@ -56,7 +56,7 @@ void Print::write(const uint8_t *buffer, size_t size) {
   while (size--) {
     if (*buffer != '\r') {
       std::putchar(*buffer++);
-      _sim::increment_counter(8 + rand() % 5);
+      _sim::increment_counter(8 + rand() % 5, _sim::API_SERIAL);
     }
     else {
       buffer++;
@@ -73,7 +73,7 @@ void Print::print(const String &s) {
     if (s[i] == '\r')
       continue;
     std::putchar(s[i]);
-    _sim::increment_counter(8 + rand() % 5);
+    _sim::increment_counter(8 + rand() % 5, _sim::API_SERIAL);
   }
   fflush(stdout);
   digitalWrite(LED_BUILTIN_TX, LOW);
@@ -175,53 +175,25 @@ void Print::println(double n, int digits) {
 // Private Methods /////////////////////////////////////////////////////////////
 
 void Print::printNumber(unsigned long n, uint8_t base) {
-  unsigned char buf[8 * sizeof(long)]; // Assumes 8-bit chars.
-  unsigned long i = 0;
+  char buf[FORMAT_BUFFER_SIZE];
 
-  if (n == 0) {
-    print('0');
-    return;
-  }
-
-  while (n > 0) {
-    buf[i++] = n % base;
-    n /= base;
-  }
+  if (base < 2) base = 10;
+  format_unsigned(n, buf, base, true);
 
-  for (; i > 0; i--)
-    print((char) (buf[i - 1] < 10 ?
-                  '0' + buf[i - 1] :
-                  'A' + buf[i - 1] - 10));
+  for (const char *p = buf; *p; p++)
+    write(*p);
 }
 
 void Print::printFloat(double number, uint8_t digits) {
-  // Handle negative numbers
-  if (number < 0.0) {
-    print('-');
-    number = -number;
-  }
-
-  // Round correctly so that print(1.999, 2) prints as "2.00"
-  double rounding = 0.5;
-  for (uint8_t i = 0; i < digits; ++i)
-    rounding /= 10.0;
-
-  number += rounding;
-
-  // Extract the integer part of the number and print it
-  unsigned long int_part = (unsigned long)number;
-  double remainder = number - (double)int_part;
-  print(int_part);
-
-  // Print the decimal point, but only if there are digits beyond
-  if (digits > 0)
-    print(".");
-
-  // Extract digits from the remainder one at a time
-  while (digits-- > 0) {
-    remainder *= 10.0;
-    int toPrint = int(remainder);
-    print(toPrint);
-    remainder -= toPrint;
+  char buf[FORMAT_FLOAT_BUFFER_SIZE(255)];
+  format_float(number, digits, buf);
+
+  // The decimal point goes through write(const char *) as it always has,
+  // so a float is charged the same virtual time as before
+  for (const char *p = buf; *p; p++) {
+    if (*p == '.')
+      print(".");
+    else
+      write(*p);
   }
 }
@@ -0,0 +1,231 @@
+/*
+  Profile.cpp - Virtual time profiler for the Arduino simulator
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "Profile.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <cxxabi.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace _sim {
+
+namespace {
+
+// Deepest stack recorded for each charge.
+const int MAX_FRAMES = 32;
+// Most frames looked through for the API function's, i.e. the simulator's
+// own between profile_charge and it.
+const int SEARCH_FRAMES = 8;
+// Shown for time the simulator charges itself, which has no stack.
+const char* const SIMULATOR = "(simulator)";
+
+typedef std::vector<void*> Stack;
+
+struct StackHash {
+  size_t operator()(const Stack& stack) const {
+    size_t h = 0;
+    for (void* frame : stack) {
+      h = h * 31 + reinterpret_cast<uintptr_t>(frame);
+    }
+    return h;
+  }
+};
+
+struct Cost {
+  uint64_t us;
+  uint64_t calls;
+};
+
+std::string prefix;
+std::unordered_map<Stack, Cost, StackHash> stacks;
+// Reused for lookups so that charging an existing stack doesn't allocate.
+Stack scratch;
+
+std::map<void*, std::pair<std::string, std::string> > symbols;
+
+// Resolve a return address to (function, call site). Only exported functions
+// have names (hence -rdynamic); anything else is shown as its object file
+// and offset, which addr2line can resolve.
+const std::pair<std::string, std::string>&
+symbolize(void* address) {
+  auto found = symbols.find(address);
+  if (found != symbols.end()) {
+    return found->second;
+  }
+
+  std::string function;
+  uintptr_t offset = 0;
+  Dl_info info;
+  // A return address can be just past the end of the calling function.
+  char* lookup = static_cast<char*>(address) - 1;
+  bool found_object = dladdr(lookup, &info) != 0;
+  bool named = found_object && info.dli_sname;
+  if (named) {
+    int status = 0;
+    char* demangled = abi::__cxa_demangle(info.dli_sname, NULL, NULL, &status);
+    function = (status == 0) ? demangled : info.dli_sname;
+    free(demangled);
+    offset = static_cast<char*>(address) - static_cast<char*>(info.dli_saddr);
+  } else if (found_object && info.dli_fname) {
+    function = strrchr(info.dli_fname, '/') ? strrchr(info.dli_fname, '/') + 1 : info.dli_fname;
+    offset = static_cast<char*>(address) - static_cast<char*>(info.dli_fbase);
+  } else {
+    function = "??";
+  }
+
+  char site[32];
+  snprintf(site, sizeof(site), "+0x%" PRIxPTR, offset);
+  return symbols[address] = std::make_pair(named ? function : "[" + function + "]", function + site);
+}
+
+// The sketch's entry points, or failing that the bottom of the stack, which
+// for the sketch is its fiber's.
+bool
+is_outermost(const std::string& function) {
+  return function == "setup()" || function == "loop()" || function == "_sim::Fiber::run(void*)";
+}
+
+void
+add(std::map<std::string, Cost>* totals, const std::string& key, const Cost& cost) {
+  Cost& total = (*totals)[key];
+  total.us += cost.us;
+  total.calls += cost.calls;
+}
+
+std::vector<std::pair<std::string, Cost> >
+most_expensive(const std::map<std::string, Cost>& totals) {
+  std::vector<std::pair<std::string, Cost> > sorted(totals.begin(), totals.end());
+  std::stable_sort(sorted.begin(), sorted.end(),
+                   [](const std::pair<std::string, Cost>& a, const std::pair<std::string, Cost>& b) {
+                     return a.second.us > b.second.us;
+                   });
+  return sorted;
+}
+
+void
+write_table(FILE* f, const char* title, const std::map<std::string, Cost>& totals, uint64_t total_us) {
+  fprintf(f, "# %s\n#   virtual_us  percent       calls  function\n", title);
+  for (const auto& row : most_expensive(totals)) {
+    fprintf(f, "%14" PRIu64 "  %6.2f%%  %10" PRIu64 "  %s\n", row.second.us,
+            total_us ? 100.0 * row.second.us / total_us : 0.0, row.second.calls, row.first.c_str());
+  }
+  fprintf(f, "\n");
+}
+
+} // namespace
+
+void
+profile_start(const char* path_prefix) {
+  prefix = path_prefix;
+}
+
+void
+profile_charge(uint64_t us, void* api) {
+  scratch.clear();
+  if (api) {
+    void* frames[SEARCH_FRAMES + MAX_FRAMES];
+    int n = backtrace(frames, SEARCH_FRAMES + MAX_FRAMES);
+    int first = 0;
+    while (first < n && first < SEARCH_FRAMES && frames[first] != api) {
+      first++;
+    }
+    if (first < n && frames[first] == api) {
+      scratch.assign(frames + first, frames + std::min(n, first + MAX_FRAMES));
+    } else {
+      scratch.push_back(api);
+    }
+  }
+  Cost& cost = stacks[scratch];
+  cost.us += us;
+  cost.calls++;
+}
+
+std::string
+symbol_name(void* return_address) {
+  return symbolize(return_address).first;
+}
+
+void
+profile_write() {
+  std::map<std::string, Cost> by_function;
+  std::map<std::string, Cost> by_site;
+  std::map<std::string, Cost> folded;
+  uint64_t total_us = 0;
+
+  for (const auto& entry : stacks) {
+    const Stack& stack = entry.first;
+    const Cost& cost = entry.second;
+    total_us += cost.us;
+
+    if (stack.empty()) {
+      add(&by_function, SIMULATOR, cost);
+      add(&by_site, SIMULATOR, cost);
+      add(&folded, SIMULATOR, cost);
+      continue;
+    }
+    const std::string& function = symbolize(stack[0]).first;
+    add(&by_function, function, cost);
+    add(&by_site, stack.size() > 1 ? function + "  <-  " + symbolize(stack[1]).second : function, cost);
+
+    // Innermost frame first, stopping at the sketch's entry point.
+    std::vector<const std::string*> names;
+    for (void* frame : stack) {
+      names.push_back(&symbolize(frame).first);
+      if (is_outermost(*names.back())) {
+        break;
+      }
+    }
+    std::string line;
+    for (auto name = names.rbegin(); name != names.rend(); ++name) {
+      line += (line.empty() ? "" : ";") + **name;
+    }
+    add(&folded, line, cost);
+  }
+
+  std::string flat_path = prefix + ".flat";
+  FILE* f = fopen(flat_path.c_str(), "w");
+  if (!f) {
+    fprintf(stderr, "Couldn't write profile to %s\n", flat_path.c_str());
+    return;
+  }
+  fprintf(f, "# Arduino time charged: %" PRIu64 " us\n\n", total_us);
+  write_table(f, "By function", by_function, total_us);
+  write_table(f, "By call site (function  <-  caller+offset)", by_site, total_us);
+  fclose(f);
+
+  std::string folded_path = prefix + ".folded";
+  f = fopen(folded_path.c_str(), "w");
+  if (!f) {
+    fprintf(stderr, "Couldn't write profile to %s\n", folded_path.c_str());
+    return;
+  }
+  for (const auto& row : folded) {
+    fprintf(f, "%s %" PRIu64 "\n", row.first.c_str(), row.second.us);
+  }
+  fclose(f);
+}
+
+}
@@ -4,6 +4,7 @@
 #include <cstring>
 #include "Arduino.h"
 #include "Device.h"
+#include "global_variables.h"
 #include "Serial.h"
 #include "WString.h"
 #include "ultoa.h"
@@ -44,6 +45,7 @@ int _Serial::peek() {
 }
 
 void _Serial::write(uint8_t c) {
+  _sim::_device.note_activity();
   putchar(c);
 }
 
@@ -54,6 +56,8 @@ void _Serial::_fill() {
   if (_in >= 0) {
     return;
   }
+  // stdin isn't paced by virtual time, so polling it is never idle
+  _sim::_device.note_activity();
   _in = getchar();
   if (_in == EOF) {
     _in = -1;
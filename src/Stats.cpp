@@ -0,0 +1,129 @@
+/*
+  Stats.cpp - Simulator statistics for the Arduino simulator
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "Stats.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <inttypes.h>
+#include <algorithm>
+
+namespace _sim {
+
+Stats _stats;
+
+namespace {
+
+const char* const API_KIND_NAMES[API_KINDS] = {
+  "other", "pin", "analog", "tone", "time", "delay", "random", "serial", "esplora",
+};
+
+// Percentiles reported for each histogram, in tenths of a percent.
+const struct {
+  const char* name;
+  uint64_t permille;
+} PERCENTILES[] = { { "p50", 500 }, { "p90", 900 }, { "p99", 990 }, { "p999", 999 } };
+const size_t NUM_PERCENTILES = sizeof(PERCENTILES) / sizeof(PERCENTILES[0]);
+
+void
+appendf(char** str, const char* end, const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  int n = vsnprintf(*str, end - *str, format, args);
+  va_end(args);
+  *str += std::min<long>(end - *str, n);
+}
+
+uint64_t
+bucket_lowest(int bucket) {
+  if (bucket < HIST_SUB_BUCKETS) {
+    return bucket;
+  }
+  int shift = bucket / HIST_SUB_BUCKETS - 1;
+  return static_cast<uint64_t>(HIST_SUB_BUCKETS + bucket % HIST_SUB_BUCKETS) << shift;
+}
+
+uint64_t
+bucket_highest(int bucket) {
+  return (bucket + 1 < HIST_BUCKETS) ? bucket_lowest(bucket + 1) - 1 : UINT64_MAX;
+}
+
+// Summary percentiles, then the non-empty buckets as [lowest value, count].
+// Like HdrHistogram, a percentile is reported as the highest value its bucket
+// could hold (but never more than the maximum seen).
+void
+histogram_to_json(char** ptr, const char* end, const Histogram& hist) {
+  uint64_t count = stat_get(hist.count);
+  uint64_t max = stat_get(hist.max);
+  appendf(ptr, end, "{ \"count\": %" PRIu64 ", \"mean\": %.1f", count,
+          count ? static_cast<double>(stat_get(hist.sum)) / count : 0.0);
+
+  size_t next = 0;
+  uint64_t seen = 0;
+  for (int i = 0; i < HIST_BUCKETS && count && next < NUM_PERCENTILES; i++) {
+    seen += stat_get(hist.counts[i]);
+    while (next < NUM_PERCENTILES && seen * 1000 >= count * PERCENTILES[next].permille) {
+      appendf(ptr, end, ", \"%s\": %" PRIu64, PERCENTILES[next++].name, std::min(bucket_highest(i), max));
+    }
+  }
+
+  appendf(ptr, end, ", \"max\": %" PRIu64 ", \"buckets\": [", max);
+  bool first = true;
+  for (int i = 0; i < HIST_BUCKETS; i++) {
+    uint64_t n = stat_get(hist.counts[i]);
+    if (n) {
+      appendf(ptr, end, "%s[%" PRIu64 ", %" PRIu64 "]", first ? "" : ", ", bucket_lowest(i), n);
+      first = false;
+    }
+  }
+  appendf(ptr, end, "] }");
+}
+
+} // namespace
+
+void
+stats_to_json(char* buf, size_t size, int64_t lag_us) {
+  char* ptr = buf;
+  const char* end = buf + size;
+  appendf(&ptr, end, "{ \"api_calls\": {");
+  for (int i = 0; i < API_KINDS; i++) {
+    appendf(&ptr, end, "%s \"%s\": %" PRIu64, i ? "," : "", API_KIND_NAMES[i],
+            stat_get(_stats.api_calls[i]));
+  }
+  appendf(&ptr, end,
+          " }, \"steps\": %" PRIu64 ", \"updates\": %" PRIu64 ", \"update_bytes\": %" PRIu64 ", "
+          "\"events\": %" PRIu64 ", \"events_rejected\": %" PRIu64 ", \"suspend_us\": %" PRIu64 ", "
+          "\"lag_us\": %" PRId64 ", \"max_lag_us\": %" PRIu64 ", ",
+          stat_get(_stats.steps), stat_get(_stats.updates), stat_get(_stats.update_bytes),
+          stat_get(_stats.events), stat_get(_stats.events_rejected), stat_get(_stats.suspend_us), lag_us,
+          stat_get(_stats.max_lag_us));
+  appendf(&ptr, end,
+          "\"update_queue\": { \"queued\": %" PRIu64 ", \"conflated\": %" PRIu64 ", \"depth\": %" PRIu64 ", "
+          "\"max_depth\": %" PRIu64 ", \"blocked_us\": %" PRIu64 " }, \"edges\": %" PRIu64 ", ",
+          stat_get(_stats.updates_queued), stat_get(_stats.updates_conflated), stat_get(_stats.update_queue_depth),
+          stat_get(_stats.update_queue_max_depth), stat_get(_stats.update_blocked_us), stat_get(_stats.edges));
+  appendf(&ptr, end,
+          "\"strings\": { \"allocs\": %" PRIu64 ", \"pool_hits\": %" PRIu64 ", \"bytes\": %" PRIu64 ", "
+          "\"cached_bytes\": %" PRIu64 " }, \"loop_period_us\": ",
+          stat_get(_stats.string_allocs), stat_get(_stats.string_pool_hits), stat_get(_stats.string_bytes),
+          stat_get(_stats.string_cached_bytes));
+  histogram_to_json(&ptr, end, _stats.loop_period_us);
+  appendf(&ptr, end, ", \"reaction_us\": ");
+  histogram_to_json(&ptr, end, _stats.reaction_us);
+  appendf(&ptr, end, " }");
+}
+
+}
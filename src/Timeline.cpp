@@ -0,0 +1,191 @@
+/*
+  Timeline.cpp - Columnar pin and mux history for the Arduino simulator
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "Timeline.h"
+
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+#include "Device.h"
+
+namespace _sim {
+
+bool timeline_recording = false;
+
+namespace {
+
+static_assert(sizeof(TimelineIndexEntry) == 40, "index entries are written as they are");
+
+// For pins, values are the state, PWM high time and PWM period. For mux
+// channels, only the first is used, for the voltage in microvolts.
+struct Change {
+  uint64_t us;
+  int64_t values[3];
+};
+
+struct Series {
+  std::vector<Change> pending;
+  Change last;
+  bool any;
+  // What last replaced, for when last is replaced in turn at the same time.
+  Change before;
+  bool any_before;
+};
+
+FILE* file = nullptr;
+uint64_t offset = 0;
+Series series[NUM_PINS + MUX_PINS];
+std::vector<TimelineIndexEntry> index;
+// Reused to encode each block.
+std::string block;
+
+void
+write_bytes(const void* data, size_t nbytes) {
+  fwrite(data, 1, nbytes, file);
+  offset += nbytes;
+}
+
+void
+write_block(int id) {
+  Series& s = series[id];
+  if (s.pending.empty()) {
+    return;
+  }
+  int columns = (id < NUM_PINS) ? 3 : 1;
+
+  block.clear();
+  uint64_t prev_us = s.pending[0].us;
+  for (const Change& change : s.pending) {
+    put_varint(&block, change.us - prev_us);
+    prev_us = change.us;
+  }
+  for (int column = 0; column < columns; column++) {
+    // Pin states are small and jump about, so they're stored as they are.
+    bool delta = (id >= NUM_PINS || column > 0);
+    int64_t prev = 0;
+    for (const Change& change : s.pending) {
+      int64_t value = change.values[column];
+      put_varint(&block, delta ? zigzag(value - prev) : static_cast<uint64_t>(value));
+      prev = value;
+    }
+  }
+
+  TimelineIndexEntry entry;
+  entry.series = id;
+  entry.changes = s.pending.size();
+  entry.first_us = s.pending.front().us;
+  entry.last_us = s.pending.back().us;
+  entry.offset = offset;
+  entry.nbytes = block.size();
+  index.push_back(entry);
+  write_bytes(block.data(), block.size());
+  s.pending.clear();
+}
+
+void
+add(int id, const Change& change) {
+  Series& s = series[id];
+  // Several changes at once, e.g. tone() setting the period and then the
+  // high time, are one change, as in the edge log. So the last is taken back
+  // and this one compared with what it replaced.
+  if (!s.pending.empty() && s.pending.back().us == change.us) {
+    s.pending.pop_back();
+    s.last = s.before;
+    s.any = s.any_before;
+  }
+  if (s.any && s.last.values[0] == change.values[0] && s.last.values[1] == change.values[1] &&
+      s.last.values[2] == change.values[2]) {
+    return;
+  }
+  // Only once the next change comes, so that a block never ends on one that
+  // could still be taken back.
+  if (s.pending.size() == TIMELINE_BLOCK_CHANGES) {
+    write_block(id);
+  }
+  s.before = s.last;
+  s.any_before = s.any;
+  s.last = change;
+  s.any = true;
+  s.pending.push_back(change);
+}
+
+} // namespace
+
+bool
+timeline_open(const char* path) {
+  // Finish any earlier one first, e.g. for -r given twice, as its state is
+  // shared.
+  timeline_close();
+  file = fopen(path, "wb");
+  if (!file) {
+    return false;
+  }
+  offset = 0;
+  index.clear();
+  uint32_t counts[2] = { NUM_PINS, MUX_PINS };
+  write_bytes(TIMELINE_MAGIC, sizeof(TIMELINE_MAGIC));
+  write_bytes(counts, sizeof(counts));
+  for (int i = 0; i < NUM_PINS + MUX_PINS; i++) {
+    series[i].pending.clear();
+    series[i].pending.reserve(TIMELINE_BLOCK_CHANGES);
+    // Pins start as OUTPUT_LOW, which readers assume, so only changes from
+    // that are recorded. Mux channels have no such default.
+    series[i].any = (i < NUM_PINS);
+    series[i].last = Change();
+  }
+  timeline_recording = true;
+  return true;
+}
+
+void
+timeline_pin(uint64_t us, int pin, int state, uint32_t pwm_high_time, uint32_t pwm_period) {
+  Change change;
+  change.us = us;
+  change.values[0] = state;
+  // As in the snapshots, which only show PWM timing for PWM pins.
+  change.values[1] = (state == GPIO_PIN_OUTPUT_PWM) ? pwm_high_time : 0;
+  change.values[2] = (state == GPIO_PIN_OUTPUT_PWM) ? pwm_period : 0;
+  add(pin, change);
+}
+
+void
+timeline_mux(uint64_t us, int channel, double voltage) {
+  Change change;
+  change.us = us;
+  change.values[0] = llround(voltage * 1e6);
+  change.values[1] = 0;
+  change.values[2] = 0;
+  add(NUM_PINS + channel, change);
+}
+
+void
+timeline_close() {
+  if (!file) {
+    return;
+  }
+  for (int i = 0; i < NUM_PINS + MUX_PINS; i++) {
+    write_block(i);
+  }
+  uint64_t footer[2] = { offset, index.size() };
+  write_bytes(index.data(), index.size() * sizeof(TimelineIndexEntry));
+  write_bytes(footer, sizeof(footer));
+  write_bytes(TIMELINE_END_MAGIC, sizeof(TIMELINE_END_MAGIC));
+  fclose(file);
+  file = nullptr;
+  timeline_recording = false;
+}
+
+}
@@ -0,0 +1,235 @@
+/*
+  TimelineReader.cpp - Queries over a columnar pin and mux history
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "TimelineReader.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include "Device.h"
+
+namespace _sim {
+
+TimelineReader::TimelineReader()
+  : _fd(-1), _pins(0), _mux_channels(0), _end_us(0), _nblocks(0), _blocks_read(0) {
+}
+
+TimelineReader::~TimelineReader() {
+  if (_fd != -1) {
+    close(_fd);
+  }
+}
+
+bool
+TimelineReader::fail(const char* why) {
+  _error = why;
+  return false;
+}
+
+bool
+TimelineReader::read_at(uint64_t offset, void* buf, size_t nbytes) {
+  char* p = static_cast<char*>(buf);
+  while (nbytes > 0) {
+    ssize_t n = pread(_fd, p, nbytes, offset);
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    offset += n;
+    nbytes -= n;
+  }
+  return true;
+}
+
+bool
+TimelineReader::open(const char* path) {
+  _fd = ::open(path, O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (_fd == -1 || fstat(_fd, &st) != 0) {
+    return fail(strerror(errno));
+  }
+  uint64_t size = st.st_size;
+
+  char magic[8];
+  uint32_t counts[2];
+  if (size < TIMELINE_HEADER_BYTES + TIMELINE_FOOTER_BYTES || !read_at(0, magic, sizeof(magic)) ||
+      memcmp(magic, TIMELINE_MAGIC, sizeof(magic)) != 0 || !read_at(sizeof(magic), counts, sizeof(counts))) {
+    return fail("not a timeline file");
+  }
+  _pins = counts[0];
+  _mux_channels = counts[1];
+
+  uint64_t footer[2];
+  if (!read_at(size - TIMELINE_FOOTER_BYTES, footer, sizeof(footer)) ||
+      !read_at(size - sizeof(magic), magic, sizeof(magic)) ||
+      memcmp(magic, TIMELINE_END_MAGIC, sizeof(magic)) != 0) {
+    return fail("no index, so the run didn't finish");
+  }
+  uint64_t index_offset = footer[0];
+  _nblocks = footer[1];
+  if (index_offset + _nblocks * sizeof(TimelineIndexEntry) + TIMELINE_FOOTER_BYTES != size) {
+    return fail("index doesn't fit the file");
+  }
+
+  std::vector<TimelineIndexEntry> entries(_nblocks);
+  if (!read_at(index_offset, entries.data(), _nblocks * sizeof(TimelineIndexEntry))) {
+    return fail("couldn't read the index");
+  }
+  _index.assign(_pins + _mux_channels, std::vector<TimelineIndexEntry>());
+  for (const TimelineIndexEntry& entry : entries) {
+    if (entry.series >= _index.size() || entry.changes == 0 || entry.offset + entry.nbytes > index_offset) {
+      return fail("bad index entry");
+    }
+    _index[entry.series].push_back(entry);
+    _end_us = std::max(_end_us, entry.last_us);
+  }
+  for (auto& blocks : _index) {
+    std::sort(blocks.begin(), blocks.end(), [](const TimelineIndexEntry& a, const TimelineIndexEntry& b) {
+      return a.first_us < b.first_us;
+    });
+  }
+  return true;
+}
+
+bool
+TimelineReader::decode(uint32_t series, const TimelineIndexEntry& entry, std::vector<Change>* out) {
+  _block.resize(entry.nbytes);
+  if (!read_at(entry.offset, _block.data(), entry.nbytes)) {
+    return fail("couldn't read a block");
+  }
+  _blocks_read++;
+  const uint8_t* p = _block.data();
+  const uint8_t* end = p + _block.size();
+
+  size_t first = out->size();
+  out->resize(first + entry.changes);
+  Change* changes = out->data() + first;
+  uint64_t us = entry.first_us;
+  for (uint32_t i = 0; i < entry.changes; i++) {
+    uint64_t delta;
+    if (!get_varint(&p, end, &delta)) {
+      return fail("truncated block");
+    }
+    us += delta;
+    changes[i].us = us;
+    changes[i].values[1] = changes[i].values[2] = 0;
+  }
+  bool is_pin = static_cast<int>(series) < _pins;
+  int columns = is_pin ? 3 : 1;
+  for (int column = 0; column < columns; column++) {
+    bool delta = !is_pin || column > 0;
+    int64_t prev = 0;
+    for (uint32_t i = 0; i < entry.changes; i++) {
+      uint64_t value;
+      if (!get_varint(&p, end, &value)) {
+        return fail("truncated block");
+      }
+      prev = delta ? prev + unzigzag(value) : static_cast<int64_t>(value);
+      changes[i].values[column] = prev;
+    }
+  }
+  return true;
+}
+
+std::vector<TimelineReader::Change>
+TimelineReader::changes(uint32_t series, uint64_t from_us, uint64_t to_us, bool with_previous) {
+  std::vector<Change> result;
+  if (series >= _index.size()) {
+    return result;
+  }
+  const std::vector<TimelineIndexEntry>& blocks = _index[series];
+  // The first block starting at or after from_us, or the one before it if
+  // that runs on past from_us or holds the previous change.
+  auto block = std::lower_bound(blocks.begin(), blocks.end(), from_us,
+                                [](const TimelineIndexEntry& entry, uint64_t us) { return entry.first_us < us; });
+  if (block != blocks.begin() && (with_previous || (block - 1)->last_us >= from_us)) {
+    --block;
+  }
+
+  std::vector<Change> decoded;
+  Change previous;
+  bool have_previous = false;
+  for (; block != blocks.end() && block->first_us <= to_us; ++block) {
+    decoded.clear();
+    if (!decode(series, *block, &decoded)) {
+      break;
+    }
+    for (const Change& change : decoded) {
+      if (change.us < from_us) {
+        previous = change;
+        have_previous = true;
+      } else if (change.us <= to_us) {
+        result.push_back(change);
+      }
+    }
+  }
+  if (with_previous && have_previous) {
+    result.insert(result.begin(), previous);
+  }
+  return result;
+}
+
+TimelinePin
+TimelineReader::pin_at(int pin, uint64_t us) {
+  TimelinePin state = { 0, GPIO_PIN_OUTPUT_LOW, 0, 0 };
+  // The change at us itself counts, so look for changes up to us + 1.
+  std::vector<Change> found = changes(pin, us + 1, us + 1, true);
+  if (!found.empty() && found[0].us <= us) {
+    state.us = found[0].us;
+    state.state = found[0].values[0];
+    state.pwm_high_time = found[0].values[1];
+    state.pwm_period = found[0].values[2];
+  }
+  return state;
+}
+
+std::vector<TimelinePin>
+TimelineReader::pin_changes(int pin, uint64_t from_us, uint64_t to_us) {
+  std::vector<TimelinePin> result;
+  for (const Change& change : changes(pin, from_us, to_us, false)) {
+    TimelinePin state = { change.us, static_cast<int>(change.values[0]), static_cast<uint32_t>(change.values[1]),
+                          static_cast<uint32_t>(change.values[2]) };
+    result.push_back(state);
+  }
+  return result;
+}
+
+TimelineMux
+TimelineReader::mux_at(int channel, uint64_t us) {
+  TimelineMux value = { 0, NAN };
+  std::vector<Change> found = changes(_pins + channel, us + 1, us + 1, true);
+  if (!found.empty() && found[0].us <= us) {
+    value.us = found[0].us;
+    value.voltage = found[0].values[0] / 1e6;
+  }
+  return value;
+}
+
+std::vector<TimelineMux>
+TimelineReader::mux_changes(int channel, uint64_t from_us, uint64_t to_us) {
+  std::vector<TimelineMux> result;
+  for (const Change& change : changes(_pins + channel, from_us, to_us, false)) {
+    TimelineMux value = { change.us, change.values[0] / 1e6 };
+    result.push_back(value);
+  }
+  return result;
+}
+
+}
@@ -0,0 +1,187 @@
+/*
+  Trace.cpp - Chrome trace export for the Arduino simulator
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "Trace.h"
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "Clock.h"
+#include "Device.h"
+#include "Profile.h"
+
+namespace _sim {
+
+namespace {
+
+// Records kept per thread. At 32 bytes each this is 8 MB, which holds the
+// last few hundred thousand API calls.
+const size_t RING_RECORDS = 1 << 18;
+
+// Chrome trace "processes" for the two timelines.
+const int WALL_PID = 1;
+const int ARDUINO_PID = 2;
+
+const char* const KIND_NAMES[TRACE_KINDS] = {
+  "setup", "loop", "api", "suspend", "sleep", "catch_up", "client_event", "update",
+};
+// What each kind's arg means, if it has one.
+const char* const ARG_NAMES[TRACE_KINDS] = {
+  nullptr, "loop", "us", nullptr, nullptr, "us", "bytes", "bytes",
+};
+
+struct Record {
+  uint64_t wall_ns;
+  uint64_t arduino_us;
+  void* where;
+  uint32_t arg;
+  uint8_t kind;
+  char phase;
+};
+
+struct Ring {
+  int tid;
+  uint64_t next;
+  std::vector<Record> records;
+};
+
+std::string path;
+uint64_t start_ns = 0;
+
+std::mutex rings_mutex;
+std::vector<Ring*> rings;
+thread_local Ring* ring = nullptr;
+
+void
+record(TraceKind kind, char phase, void* where, uint32_t arg) {
+  if (!ring) {
+    ring = new Ring();
+    ring->next = 0;
+    ring->records.resize(RING_RECORDS);
+    std::lock_guard<std::mutex> lock(rings_mutex);
+    ring->tid = rings.size() + 1;
+    rings.push_back(ring);
+  }
+  Record& r = ring->records[ring->next++ % RING_RECORDS];
+  r.wall_ns = monotonic_nanos();
+  r.arduino_us = get_arduino_micros();
+  r.where = where;
+  r.arg = arg;
+  r.kind = kind;
+  r.phase = phase;
+}
+
+void
+write_event(FILE* f, bool* first, int pid, int tid, const char* name, char phase, double ts, const char* args) {
+  fprintf(f, "%s\n{\"name\": \"%s\", \"ph\": \"%c\", \"pid\": %d, \"tid\": %d, \"ts\": %.3f%s%s}",
+          *first ? "" : ",", name, phase, pid, tid, ts, phase == 'i' ? ", \"s\": \"t\"" : "", args);
+  *first = false;
+}
+
+void
+write_metadata(FILE* f, bool* first, int pid, const char* name) {
+  fprintf(f, "%s\n{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"args\": {\"name\": \"%s\"}}",
+          *first ? "" : ",", pid, name);
+  *first = false;
+}
+
+} // namespace
+
+void
+trace_start(const char* trace_path) {
+  path = trace_path;
+  start_ns = monotonic_nanos();
+}
+
+void
+trace_begin(TraceKind kind, void* where, uint32_t arg) {
+  record(kind, 'B', where, arg);
+}
+
+void
+trace_end(TraceKind kind) {
+  record(kind, 'E', nullptr, 0);
+}
+
+void
+trace_instant(TraceKind kind, uint32_t arg) {
+  record(kind, 'i', nullptr, arg);
+}
+
+void
+trace_write() {
+  FILE* f = fopen(path.c_str(), "w");
+  if (!f) {
+    fprintf(stderr, "Couldn't write trace to %s\n", path.c_str());
+    return;
+  }
+
+  std::map<void*, std::string> names;
+  bool first = true;
+  fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+  write_metadata(f, &first, WALL_PID, "Wall clock");
+  write_metadata(f, &first, ARDUINO_PID, "Arduino time");
+
+  std::lock_guard<std::mutex> lock(rings_mutex);
+  for (Ring* r : rings) {
+    uint64_t begin = (r->next > RING_RECORDS) ? r->next - RING_RECORDS : 0;
+    // Ends whose begin has been overwritten are dropped, so every span the
+    // viewer sees is complete apart from those still open at exit.
+    int depth = 0;
+    for (uint64_t i = begin; i < r->next; i++) {
+      const Record& rec = r->records[i % RING_RECORDS];
+      if (rec.phase == 'E' && depth == 0) {
+        continue;
+      }
+      depth += (rec.phase == 'B') - (rec.phase == 'E');
+
+      const char* name = KIND_NAMES[rec.kind];
+      if (rec.where) {
+        auto found = names.find(rec.where);
+        if (found == names.end()) {
+          found = names.insert(std::make_pair(rec.where, symbol_name(rec.where))).first;
+        }
+        // Functions without exported names (see Profile.cpp) keep the kind's name.
+        if (found->second[0] != '[') {
+          name = found->second.c_str();
+        }
+      }
+
+      double wall_us = (rec.wall_ns - start_ns) / 1000.0;
+      char arg[64] = "";
+      if (ARG_NAMES[rec.kind]) {
+        snprintf(arg, sizeof(arg), ", \"%s\": %" PRIu32, ARG_NAMES[rec.kind], rec.arg);
+      }
+      // Each record goes on both timelines, with the other timestamp as an arg.
+      char args[128] = "";
+      if (rec.phase != 'E') {
+        snprintf(args, sizeof(args), ", \"args\": {\"arduino_us\": %" PRIu64 "%s}", rec.arduino_us, arg);
+      }
+      write_event(f, &first, WALL_PID, r->tid, name, rec.phase, wall_us, args);
+      if (rec.phase != 'E') {
+        snprintf(args, sizeof(args), ", \"args\": {\"wall_us\": %.3f%s}", wall_us, arg);
+      }
+      write_event(f, &first, ARDUINO_PID, r->tid, name, rec.phase, rec.arduino_us, args);
+    }
+  }
+  fprintf(f, "\n]}\n");
+  fclose(f);
+}
+
+}
@@ -0,0 +1,193 @@
+/*
+  UpdateQueue.cpp - Conflating output queue for the Arduino simulator
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "UpdateQueue.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "Clock.h"
+#include "Stats.h"
+
+namespace _sim {
+
+namespace {
+
+const char* const UPDATE_TYPE_NAMES[UPDATE_TYPES] = {
+  "arduino_pins", "arduino_heartbeat", "random_state", "sim_stats", "arduino_hello", "arduino_bye",
+  "arduino_ack", "marker_failure", "arduino_reaction", "budget_exceeded", "arduino_edges",
+  "arduino_step_done",
+};
+
+} // namespace
+
+const char*
+update_type_name(UpdateType type) {
+  return UPDATE_TYPE_NAMES[type];
+}
+
+UpdateType
+update_type_named(const char* name, size_t length) {
+  for (int i = 0; i < UPDATE_TYPES; i++) {
+    if (strlen(UPDATE_TYPE_NAMES[i]) == length && strncmp(UPDATE_TYPE_NAMES[i], name, length) == 0) {
+      return static_cast<UpdateType>(i);
+    }
+  }
+  return UPDATE_TYPES;
+}
+
+UpdateQueue::UpdateQueue()
+  : _fd(-1), _original_flags(-1), _max_bytes(0), _front_written(0), _queued_bytes(0) {
+}
+
+void
+UpdateQueue::open(int fd, size_t max_bytes) {
+  _fd = fd;
+  _max_bytes = max_bytes;
+  // Writes to a regular file never block, so only pipes and sockets need
+  // O_NONBLOCK. The flag is shared with anything else holding the same open
+  // pipe, so it comes off again in drain.
+  struct stat st;
+  if (_fd == -1 || fstat(_fd, &st) != 0 || S_ISREG(st.st_mode)) {
+    return;
+  }
+  _original_flags = fcntl(_fd, F_GETFL, 0);
+  if (_original_flags != -1) {
+    fcntl(_fd, F_SETFL, _original_flags | O_NONBLOCK);
+  }
+}
+
+// Like write(2), but retrying on EINTR and returning 0 rather than -1 when
+// the fd is full.
+ssize_t
+UpdateQueue::write_some(const char* data, size_t count) {
+  ssize_t n;
+  do {
+    n = ::write(_fd, data, count);
+  } while (n == -1 && errno == EINTR);
+  if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    return 0;
+  }
+  return n;
+}
+
+void
+UpdateQueue::pop_front() {
+  _queued_bytes -= _queue.front().data.size();
+  _queue.pop_front();
+  _front_written = 0;
+  stat_sub(_stats.update_queue_depth, 1);
+}
+
+// Forget everything queued, e.g. once the consumer has closed its end.
+void
+UpdateQueue::discard() {
+  while (!_queue.empty()) {
+    pop_front();
+  }
+}
+
+void
+UpdateQueue::enqueue(const char* data, size_t count, size_t written, UpdateType type) {
+  if (is_snapshot(type)) {
+    for (auto older = _queue.begin() + (_front_written ? 1 : 0); older != _queue.end(); ++older) {
+      if (older->type == type) {
+        _queued_bytes -= older->data.size();
+        _queue.erase(older);
+        stat_sub(_stats.update_queue_depth, 1);
+        stat_add(_stats.updates_conflated);
+        break;
+      }
+    }
+  }
+  // The newest snapshot goes to the back, so it still follows any ack that
+  // was sent before it.
+  if (_queue.empty()) {
+    _front_written = written;
+  }
+  _queue.push_back(Update{ std::string(data, count), type });
+  _queued_bytes += count;
+  stat_add(_stats.updates_queued);
+  stat_add(_stats.update_queue_depth);
+  stat_max(_stats.update_queue_max_depth, stat_get(_stats.update_queue_depth));
+}
+
+void
+UpdateQueue::write(const void* buf, size_t count, UpdateType type) {
+  const char* data = static_cast<const char*>(buf);
+  flush();
+  size_t written = 0;
+  if (_queue.empty()) {
+    ssize_t n = write_some(data, count);
+    if (n == -1 || static_cast<size_t>(n) == count) {
+      // Done, or the consumer has gone, in which case there's nobody to
+      // queue for.
+      return;
+    }
+    written = n;
+  }
+  enqueue(data, count, written, type);
+
+  if (_queued_bytes > _max_bytes) {
+    uint64_t start_us = monotonic_micros();
+    while (_queued_bytes > _max_bytes) {
+      struct pollfd pfd;
+      pfd.fd = _fd;
+      pfd.events = POLLOUT;
+      pfd.revents = 0;
+      if (poll(&pfd, 1, -1) == -1 && errno != EINTR) {
+        discard();
+        break;
+      }
+      flush();
+    }
+    stat_add(_stats.update_blocked_us, monotonic_micros() - start_us);
+  }
+}
+
+void
+UpdateQueue::flush() {
+  while (!_queue.empty()) {
+    const std::string& data = _queue.front().data;
+    ssize_t n = write_some(data.data() + _front_written, data.size() - _front_written);
+    if (n == -1) {
+      discard();
+      return;
+    }
+    if (n == 0) {
+      return;
+    }
+    _front_written += n;
+    if (_front_written == data.size()) {
+      pop_front();
+    }
+  }
+}
+
+void
+UpdateQueue::drain() {
+  if (_original_flags != -1) {
+    fcntl(_fd, F_SETFL, _original_flags);
+    _original_flags = -1;
+  }
+  // Now blocking, so this only returns once the queue is empty.
+  flush();
+}
+
+}
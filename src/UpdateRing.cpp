@@ -0,0 +1,228 @@
+/*
+  UpdateRing.cpp - Memory mapped ring of updates for local readers
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "UpdateRing.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace _sim {
+
+UpdateRing::UpdateRing() : _header(nullptr), _records(nullptr), _capacity(0), _head(0), _tail(0), _seq(0) {
+}
+
+bool
+UpdateRing::open(const char* path, size_t capacity) {
+  _capacity = UPDATE_RING_MIN_BYTES;
+  while (_capacity < capacity) {
+    _capacity <<= 1;
+  }
+  size_t map_bytes = sizeof(UpdateRingHeader) + _capacity;
+
+  int fd = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  if (fd == -1) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    ::close(fd);
+    return false;
+  }
+  // Reusing the file rather than replacing it lets readers that are already
+  // following it carry on into this run.
+  UpdateRingHeader old;
+  uint32_t run = 0;
+  if (pread(fd, &old, sizeof(old), 0) == sizeof(old) && memcmp(old.magic, UPDATE_RING_MAGIC, sizeof(old.magic)) == 0) {
+    run = old.run + 1;
+  }
+  if (static_cast<size_t>(st.st_size) != map_bytes && ftruncate(fd, map_bytes) != 0) {
+    ::close(fd);
+    return false;
+  }
+  void* map = mmap(nullptr, map_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (map == MAP_FAILED) {
+    return false;
+  }
+  _header = static_cast<UpdateRingHeader*>(map);
+  _records = static_cast<char*>(map) + sizeof(UpdateRingHeader);
+
+  // The new run number goes first, so that a reader part way through a
+  // record of the last run sees it has changed.
+  __atomic_store_n(&_header->run, run, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  __atomic_store_n(&_header->capacity, _capacity, __ATOMIC_RELAXED);
+  __atomic_store_n(&_header->head, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&_header->tail, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&_header->closed, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy(_header->magic, UPDATE_RING_MAGIC, sizeof(_header->magic));
+  return true;
+}
+
+void
+UpdateRing::append(uint64_t seq, uint16_t type, const void* buf, uint32_t size) {
+  uint64_t bytes = update_record_bytes(size);
+  if (_head + bytes - _tail > _capacity) {
+    while (_head + bytes - _tail > _capacity) {
+      const UpdateRecordHeader* oldest =
+        reinterpret_cast<const UpdateRecordHeader*>(_records + (_tail & (_capacity - 1)));
+      _tail += update_record_bytes(oldest->size);
+    }
+    // Readers have to see the records are gone before they're overwritten.
+    __atomic_store_n(&_header->tail, _tail, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+  }
+  UpdateRecordHeader* record = reinterpret_cast<UpdateRecordHeader*>(_records + (_head & (_capacity - 1)));
+  record->seq = seq;
+  record->size = size;
+  record->type = type;
+  record->unused = 0;
+  if (buf) {
+    memcpy(record + 1, buf, size);
+  }
+  _head += bytes;
+  __atomic_store_n(&_header->head, _head, __ATOMIC_RELEASE);
+}
+
+void
+UpdateRing::write(const void* buf, size_t count, UpdateType type) {
+  _seq++;
+  uint64_t bytes = update_record_bytes(count);
+  if (bytes > _capacity) {
+    return;
+  }
+  uint64_t offset = _head & (_capacity - 1);
+  if (offset + bytes > _capacity) {
+    append(0, UPDATE_RECORD_PADDING, nullptr, _capacity - offset - sizeof(UpdateRecordHeader));
+  }
+  append(_seq, type, buf, count);
+}
+
+void
+UpdateRing::close() {
+  if (!_header) {
+    return;
+  }
+  __atomic_store_n(&_header->closed, 1, __ATOMIC_RELEASE);
+  munmap(_header, sizeof(UpdateRingHeader) + _capacity);
+  _header = nullptr;
+}
+
+UpdateRingReader::UpdateRingReader()
+  : _header(nullptr), _records(nullptr), _map_bytes(0), _capacity(0), _run(0), _stale(false), _position(0),
+    _next_seq(0), _lost(0) {
+}
+
+UpdateRingReader::~UpdateRingReader() {
+  if (_header) {
+    munmap(const_cast<UpdateRingHeader*>(_header), _map_bytes);
+  }
+}
+
+bool
+UpdateRingReader::open(const char* path, bool from_oldest) {
+  int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (fd == -1 || fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(UpdateRingHeader)) {
+    if (fd != -1) {
+      ::close(fd);
+    }
+    return false;
+  }
+  _map_bytes = st.st_size;
+  void* map = mmap(nullptr, _map_bytes, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (map == MAP_FAILED) {
+    return false;
+  }
+  _header = static_cast<const UpdateRingHeader*>(map);
+  _records = static_cast<const char*>(map) + sizeof(UpdateRingHeader);
+  _capacity = __atomic_load_n(&_header->capacity, __ATOMIC_ACQUIRE);
+  if (memcmp(_header->magic, UPDATE_RING_MAGIC, sizeof(_header->magic)) != 0 ||
+      sizeof(UpdateRingHeader) + _capacity > _map_bytes) {
+    return false;
+  }
+  _run = __atomic_load_n(&_header->run, __ATOMIC_ACQUIRE);
+  _position = __atomic_load_n(from_oldest ? &_header->tail : &_header->head, __ATOMIC_ACQUIRE);
+  return true;
+}
+
+bool
+UpdateRingReader::next(std::string* data, UpdateType* type) {
+  while (!_stale) {
+    uint32_t run = __atomic_load_n(&_header->run, __ATOMIC_ACQUIRE);
+    if (run != _run) {
+      if (__atomic_load_n(&_header->capacity, __ATOMIC_RELAXED) != _capacity) {
+        _stale = true;
+        break;
+      }
+      _run = run;
+      _position = __atomic_load_n(&_header->tail, __ATOMIC_ACQUIRE);
+      _next_seq = 0;
+      continue;
+    }
+    uint64_t head = __atomic_load_n(&_header->head, __ATOMIC_ACQUIRE);
+    if (head <= _position) {
+      // Nothing new, or a new run is being set up.
+      return false;
+    }
+    uint64_t tail = __atomic_load_n(&_header->tail, __ATOMIC_ACQUIRE);
+    if (_position < tail) {
+      _position = tail;
+      continue;
+    }
+
+    uint64_t offset = _position & (_capacity - 1);
+    UpdateRecordHeader record;
+    memcpy(&record, _records + offset, sizeof(record));
+    // If the writer has overwritten the record, size may be anything.
+    bool fits = offset + update_record_bytes(record.size) <= _capacity;
+    if (fits && record.type != UPDATE_RECORD_PADDING) {
+      data->assign(_records + offset + sizeof(record), record.size);
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&_header->tail, __ATOMIC_RELAXED) > _position ||
+        __atomic_load_n(&_header->run, __ATOMIC_RELAXED) != _run) {
+      continue;
+    }
+    if (!fits) {
+      _stale = true;
+      break;
+    }
+    _position += update_record_bytes(record.size);
+    if (record.type == UPDATE_RECORD_PADDING) {
+      continue;
+    }
+    if (_next_seq && record.seq > _next_seq) {
+      _lost += record.seq - _next_seq;
+    }
+    _next_seq = record.seq + 1;
+    *type = static_cast<UpdateType>(record.type);
+    return true;
+  }
+  return false;
+}
+
+bool
+UpdateRingReader::closed() const {
+  return _stale || __atomic_load_n(&_header->closed, __ATOMIC_ACQUIRE);
+}
+
+}
@@ -0,0 +1,288 @@
+/*
+  UpdateSinks.cpp - Fan-out of updates to several consumers
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "UpdateSinks.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "Device.h"
+
+namespace _sim {
+
+namespace {
+
+const size_t DEFAULT_QUEUE_BYTES = 1 << 20;
+const size_t DEFAULT_RING_BYTES = 4 << 20;
+const uint32_t ALL_TYPES = (1u << UPDATE_TYPES) - 1;
+const uint64_t ALL_PINS = (1ull << NUM_PINS) - 1;
+
+struct Sink {
+  // A sink writes to either a queue or, if ring_open, a ring.
+  UpdateQueue queue;
+  UpdateRing ring;
+  bool ring_open;
+  // Update types subscribed to, by bit.
+  uint32_t types;
+  // Pins whose changes earn a snapshot, by bit.
+  uint64_t pins;
+  uint64_t period_us;
+  uint64_t next_pins_us;
+  // The pin state as of the last snapshot this sink was sent.
+  int sent_pins[NUM_PINS];
+  int sent_pwm_high_time[NUM_PINS];
+  int sent_pwm_period[NUM_PINS];
+};
+
+Sink sinks[MAX_SINKS];
+int nsinks = 0;
+
+void __attribute__((noreturn))
+bad_sink(const char* spec, const char* why) {
+  fprintf(stderr, "Bad update sink \"%s\": %s\n", spec, why);
+  exit(EXIT_FAILURE);
+}
+
+Sink&
+add_sink(int fd, uint64_t period_us, size_t queue_bytes) {
+  Sink& sink = sinks[nsinks++];
+  sink.queue.open(fd, queue_bytes);
+  sink.ring_open = false;
+  sink.types = ALL_TYPES;
+  sink.pins = ALL_PINS;
+  sink.period_us = period_us;
+  sink.next_pins_us = 0;
+  memset(sink.sent_pins, 0, sizeof(sink.sent_pins));
+  memset(sink.sent_pwm_high_time, 0, sizeof(sink.sent_pwm_high_time));
+  memset(sink.sent_pwm_period, 0, sizeof(sink.sent_pwm_period));
+  return sink;
+}
+
+// Parse "a+b+c" into a bitmask, with bit_for giving each item's bit or -1
+// if it isn't valid.
+template <typename BitFor>
+uint64_t
+parse_set(char* list, const char* spec, BitFor bit_for) {
+  uint64_t set = 0;
+  char* save;
+  for (char* item = strtok_r(list, "+", &save); item; item = strtok_r(NULL, "+", &save)) {
+    int bit = bit_for(item);
+    if (bit < 0) {
+      bad_sink(spec, item);
+    }
+    set |= 1ull << bit;
+  }
+  return set;
+}
+
+void
+parse_sink(char* spec, uint64_t default_period_us) {
+  if (nsinks == MAX_SINKS) {
+    bad_sink(spec, "too many sinks");
+  }
+  // Kept for error messages, as strtok_r cuts spec up.
+  char* whole = strdup(spec);
+  int fd = -1;
+  const char* ring = nullptr;
+  size_t ring_bytes = DEFAULT_RING_BYTES;
+  char* types = nullptr;
+  char* pins = nullptr;
+  uint64_t period_us = default_period_us;
+  size_t queue_bytes = DEFAULT_QUEUE_BYTES;
+
+  char* save;
+  for (char* option = strtok_r(spec, ",", &save); option; option = strtok_r(NULL, ",", &save)) {
+    char* value = strchr(option, '=');
+    if (!value) {
+      bad_sink(whole, option);
+    }
+    *value++ = '\0';
+    if (strcmp(option, "fd") == 0) {
+      char* end;
+      long n = strtol(value, &end, 10);
+      if (*end || end == value || n < 0 || n > INT_MAX || fcntl(n, F_GETFD) == -1) {
+        bad_sink(whole, "fd= isn't an open file descriptor");
+      }
+      fd = n;
+    } else if (strcmp(option, "file") == 0) {
+      fd = open(value, O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR);
+      if (fd == -1) {
+        bad_sink(whole, "couldn't open the file");
+      }
+    } else if (strcmp(option, "ring") == 0) {
+      ring = value;
+    } else if (strcmp(option, "ring_kb") == 0) {
+      ring_bytes = strtoull(value, NULL, 10) * 1024;
+    } else if (strcmp(option, "types") == 0) {
+      types = value;
+    } else if (strcmp(option, "pins") == 0) {
+      pins = value;
+    } else if (strcmp(option, "period_ms") == 0) {
+      // Any more often would sample the pins on every API call.
+      period_us = strtoull(value, NULL, 10) * 1000;
+      if (period_us == 0) {
+        bad_sink(whole, "period_ms= must be at least 1");
+      }
+    } else if (strcmp(option, "queue_kb") == 0) {
+      queue_bytes = strtoull(value, NULL, 10) * 1024;
+    } else {
+      bad_sink(whole, option);
+    }
+  }
+  if ((fd == -1) == !ring) {
+    bad_sink(whole, "needs one of fd=, file= or ring=");
+  }
+
+  Sink& sink = add_sink(fd, period_us, queue_bytes);
+  if (ring) {
+    if (!sink.ring.open(ring, ring_bytes)) {
+      bad_sink(whole, "couldn't map the ring");
+    }
+    sink.ring_open = true;
+  }
+  if (types) {
+    sink.types = parse_set(types, whole, [](const char* name) {
+      UpdateType type = update_type_named(name, strlen(name));
+      return type == UPDATE_TYPES ? -1 : static_cast<int>(type);
+    });
+  }
+  if (pins) {
+    sink.pins = parse_set(pins, whole, [](const char* pin) {
+      char* end;
+      long n = strtol(pin, &end, 10);
+      return (*end || end == pin || n < 0 || n >= NUM_PINS) ? -1 : static_cast<int>(n);
+    });
+  }
+  free(whole);
+}
+
+bool
+changed(const int* a, const int* b, uint64_t pins) {
+  for (int i = 0; i < NUM_PINS; i++) {
+    if ((pins >> i & 1) && a[i] != b[i]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace
+
+void
+update_sinks_open(int primary_fd, uint64_t period_us) {
+  add_sink(primary_fd, period_us, DEFAULT_QUEUE_BYTES);
+
+  const char* env = getenv("GROK_UPDATE_SINKS");
+  if (!env) {
+    return;
+  }
+  char* specs = strdup(env);
+  char* save;
+  for (char* spec = strtok_r(specs, ";", &save); spec; spec = strtok_r(NULL, ";", &save)) {
+    parse_sink(spec, period_us);
+  }
+  free(specs);
+}
+
+uint64_t
+update_sinks_period_us() {
+  uint64_t period_us = sinks[0].period_us;
+  for (int i = 1; i < nsinks; i++) {
+    if (sinks[i].types >> UPDATE_PINS & 1) {
+      period_us = std::min(period_us, sinks[i].period_us);
+    }
+  }
+  return period_us;
+}
+
+SinkSet
+update_sinks_pins_due(const int* pins, const int* pwm_high_time, const int* pwm_period, uint64_t now_us,
+                      bool force) {
+  SinkSet due = 0;
+  for (int i = 0; i < nsinks; i++) {
+    Sink& sink = sinks[i];
+    if (!(sink.types >> UPDATE_PINS & 1) || (!force && now_us < sink.next_pins_us)) {
+      continue;
+    }
+    if (changed(pins, sink.sent_pins, sink.pins) || changed(pwm_high_time, sink.sent_pwm_high_time, sink.pins) ||
+        changed(pwm_period, sink.sent_pwm_period, sink.pins)) {
+      due |= 1u << i;
+      sink.next_pins_us = now_us + sink.period_us;
+      memcpy(sink.sent_pins, pins, sizeof(sink.sent_pins));
+      memcpy(sink.sent_pwm_high_time, pwm_high_time, sizeof(sink.sent_pwm_high_time));
+      memcpy(sink.sent_pwm_period, pwm_period, sizeof(sink.sent_pwm_period));
+    }
+  }
+  return due;
+}
+
+SinkSet
+update_sinks_write(SinkSet to, UpdateType type, const void* buf, size_t count) {
+  SinkSet written = 0;
+  for (int i = 0; i < nsinks; i++) {
+    if ((to >> i & 1) && (sinks[i].types >> type & 1)) {
+      if (sinks[i].ring_open) {
+        sinks[i].ring.write(buf, count, type);
+      } else {
+        sinks[i].queue.write(buf, count, type);
+      }
+      written |= 1u << i;
+    }
+  }
+  return written;
+}
+
+void
+update_sinks_flush() {
+  for (int i = 0; i < nsinks; i++) {
+    if (sinks[i].queue.pending()) {
+      sinks[i].queue.flush();
+    }
+  }
+}
+
+int
+update_sinks_poll_fds(struct pollfd* pfds) {
+  int n = 0;
+  for (int i = 0; i < nsinks; i++) {
+    if (sinks[i].queue.pending()) {
+      pfds[n].fd = sinks[i].queue.fd();
+      pfds[n].events = POLLOUT;
+      pfds[n].revents = 0;
+      n++;
+    }
+  }
+  return n;
+}
+
+void
+update_sinks_close() {
+  for (int i = 0; i < nsinks; i++) {
+    if (sinks[i].ring_open) {
+      sinks[i].ring.close();
+    } else {
+      sinks[i].queue.drain();
+      close(sinks[i].queue.fd());
+    }
+  }
+  nsinks = 0;
+}
+
+}
@@ -21,6 +21,92 @@
 */
 
 #include "WString.h"
+#include "Embed.h"
+#include "Stats.h"
+
+/*********************************************/
+/*  String Pool                              */
+/*********************************************/
+
+// Heap buffers come from power of two size classes, from STRING_MIN_BLOCK up
+// to STRING_MAX_BLOCK bytes, and freed blocks are kept on a free list per
+// class for the next string that needs one. Bigger buffers go straight to
+// malloc. Strings are only used from the sketch thread, so there's no lock.
+namespace {
+
+const size_t STRING_MIN_BLOCK = 32;
+const size_t STRING_MAX_BLOCK = 4096;
+const int STRING_CLASSES = 8;
+// Free blocks beyond this many bytes are returned to malloc.
+const uint64_t STRING_MAX_CACHED = 256 * 1024;
+
+struct FreeBlock {
+  FreeBlock *next;
+};
+
+FreeBlock *free_blocks[STRING_CLASSES];
+// Bytes held on the free lists, kept here rather than read back from the
+// stats so that resetting those can't lift the cap.
+uint64_t cached_bytes = 0;
+
+int string_class(size_t bytes) {
+  int c = 0;
+  while ((STRING_MIN_BLOCK << c) < bytes) c++;
+  return c;
+}
+
+// Allocate at least *bytes, setting *bytes to the size actually provided.
+char *string_alloc(size_t *bytes) {
+  _sim::stat_add(_sim::_stats.string_allocs);
+  if (*bytes > STRING_MAX_BLOCK) {
+    char *block = (char *)malloc(*bytes);
+    if (block) _sim::stat_add(_sim::_stats.string_bytes, *bytes);
+    return block;
+  }
+  int c = string_class(*bytes);
+  *bytes = STRING_MIN_BLOCK << c;
+  char *block;
+  if (free_blocks[c]) {
+    block = (char *)free_blocks[c];
+    free_blocks[c] = free_blocks[c]->next;
+    _sim::stat_add(_sim::_stats.string_pool_hits);
+    cached_bytes -= *bytes;
+    _sim::stat_set(_sim::_stats.string_cached_bytes, cached_bytes);
+  } else {
+    block = (char *)malloc(*bytes);
+    if (!block) return NULL;
+  }
+  _sim::stat_add(_sim::_stats.string_bytes, *bytes);
+  return block;
+}
+
+void string_free(char *block, size_t bytes) {
+  _sim::stat_sub(_sim::_stats.string_bytes, bytes);
+  if (bytes > STRING_MAX_BLOCK || cached_bytes + bytes > STRING_MAX_CACHED) {
+    free(block);
+    return;
+  }
+  int c = string_class(bytes);
+  FreeBlock *freed = (FreeBlock *)block;
+  freed->next = free_blocks[c];
+  free_blocks[c] = freed;
+  cached_bytes += bytes;
+  _sim::stat_set(_sim::_stats.string_cached_bytes, cached_bytes);
+}
+
+}
+
+void _sim::string_pool_clear() {
+  for (int c = 0; c < STRING_CLASSES; c++) {
+    while (free_blocks[c]) {
+      FreeBlock *block = free_blocks[c];
+      free_blocks[c] = block->next;
+      free(block);
+    }
+  }
+  cached_bytes = 0;
+  _sim::stat_set(_sim::_stats.string_cached_bytes, cached_bytes);
+}
 
 
 /*********************************************/
@@ -37,7 +123,7 @@ String::String(const String &value) {
   *this = value;
 }
 
-#ifdef __GXX_EXPERIMENTAL_CXX0X__
+#if __cplusplus >= 201103L
 String::String(String &&rval) {
   init();
   move(rval);
@@ -92,7 +178,7 @@ String::String(unsigned long value, unsigned char base) {
 }
 
 String::~String() {
-  free(buffer);
+  release();
 }
 
 /*********************************************/
@@ -107,11 +193,16 @@ inline void String::init(void) {
 }
 
 void String::invalidate(void) {
-  if (buffer) free(buffer);
+  release();
   buffer = NULL;
   capacity = len = 0;
 }
 
+// Give back a pooled buffer. The caller resets buffer.
+void String::release(void) {
+  if (buffer && buffer != sso) string_free(buffer, capacity + 1);
+}
+
 unsigned char String::reserve(unsigned int size) {
   if (buffer && capacity >= size) return 1;
   if (changeBuffer(size)) {
@@ -121,14 +212,25 @@ unsigned char String::reserve(unsigned int size) {
   return 0;
 }
 
+// Grow the buffer, keeping its contents. Capacity at least doubles each time,
+// so building a string a character at a time doesn't copy it every time.
 unsigned char String::changeBuffer(unsigned int maxStrLen) {
-  char *newbuffer = (char *)realloc(buffer, maxStrLen + 1);
-  if (newbuffer) {
-    buffer = newbuffer;
-    capacity = maxStrLen;
+  if (!buffer && maxStrLen <= SSO_CAPACITY) {
+    buffer = sso;
+    capacity = SSO_CAPACITY;
     return 1;
   }
-  return 0;
+  size_t bytes = maxStrLen + 1;
+  if (buffer && bytes < 2 * (size_t)(capacity + 1)) bytes = 2 * (size_t)(capacity + 1);
+  char *newbuffer = string_alloc(&bytes);
+  if (!newbuffer) return 0;
+  if (buffer) {
+    memcpy(newbuffer, buffer, len + 1);
+    release();
+  }
+  buffer = newbuffer;
+  capacity = bytes - 1;
+  return 1;
 }
 
 /*********************************************/
@@ -145,20 +247,27 @@ String & String::copy(const char *cstr, unsigned int length) {
   return *this;
 }
 
-#ifdef __GXX_EXPERIMENTAL_CXX0X__
+#if __cplusplus >= 201103L
 void String::move(String &rhs) {
   if (buffer) {
-    if (capacity >= rhs.len) {
+    if (rhs.buffer && capacity >= rhs.len) {
       strcpy(buffer, rhs.buffer);
       len = rhs.len;
       rhs.len = 0;
       return;
     } else {
-      free(buffer);
+      release();
     }
   }
-  buffer = rhs.buffer;
-  capacity = rhs.capacity;
+  if (rhs.buffer == rhs.sso) {
+    // inline strings can't be stolen, but they're short
+    buffer = sso;
+    capacity = SSO_CAPACITY;
+    memcpy(sso, rhs.sso, rhs.len + 1);
+  } else {
+    buffer = rhs.buffer;
+    capacity = rhs.capacity;
+  }
   len = rhs.len;
   rhs.buffer = NULL;
   rhs.capacity = 0;
@@ -175,7 +284,7 @@ String & String::operator = (const String &rhs) {
   return *this;
 }
 
-#ifdef __GXX_EXPERIMENTAL_CXX0X__
+#if __cplusplus >= 201103L
 String & String::operator = (String &&rval) {
   if (this != &rval) move(rval);
   return *this;
@@ -202,6 +311,17 @@ unsigned char String::concat(const String &s) {
   return concat(s.buffer, s.len);
 }
 
+#if __cplusplus >= 201103L
+unsigned char String::concat(String &&rval) {
+  // appending to an empty string is just taking the other one's buffer
+  if (len == 0 && rval.buffer && this != &rval) {
+    move(rval);
+    return 1;
+  }
+  return concat(rval.buffer, rval.len);
+}
+#endif
+
 unsigned char String::concat(const char *cstr, unsigned int length) {
   unsigned int newlen = len + length;
   if (!cstr) return 0;
@@ -226,32 +346,27 @@ unsigned char String::concat(char c) {
 
 unsigned char String::concat(unsigned char num) {
   char buf[1 + 3 * sizeof(unsigned char)];
-  itoa(num, buf, 10);
-  return concat(buf, strlen(buf));
+  return concat(buf, format_unsigned(num, buf, 10));
 }
 
 unsigned char String::concat(int num) {
   char buf[2 + 3 * sizeof(int)];
-  itoa(num, buf, 10);
-  return concat(buf, strlen(buf));
+  return concat(buf, format_signed(num, buf, 10));
 }
 
 unsigned char String::concat(unsigned int num) {
   char buf[1 + 3 * sizeof(unsigned int)];
-  utoa(num, buf, 10);
-  return concat(buf, strlen(buf));
+  return concat(buf, format_unsigned(num, buf, 10));
 }
 
 unsigned char String::concat(long num) {
   char buf[2 + 3 * sizeof(long)];
-  ltoa(num, buf, 10);
-  return concat(buf, strlen(buf));
+  return concat(buf, format_signed(num, buf, 10));
 }
 
 unsigned char String::concat(unsigned long num) {
   char buf[1 + 3 * sizeof(unsigned long)];
-  ultoa(num, buf, 10);
-  return concat(buf, strlen(buf));
+  return concat(buf, format_unsigned(num, buf, 10));
 }
 
 /*********************************************/
@@ -306,6 +421,48 @@ StringSumHelper & operator + (const StringSumHelper &lhs, unsigned long num) {
   return a;
 }
 
+#if __cplusplus >= 201103L
+StringSumHelper && operator + (StringSumHelper &&lhs, const String &rhs) {
+  if (!lhs.concat(rhs.buffer, rhs.len)) lhs.invalidate();
+  return static_cast<StringSumHelper &&>(lhs);
+}
+
+StringSumHelper && operator + (StringSumHelper &&lhs, const char *cstr) {
+  if (!cstr || !lhs.concat(cstr, strlen(cstr))) lhs.invalidate();
+  return static_cast<StringSumHelper &&>(lhs);
+}
+
+StringSumHelper && operator + (StringSumHelper &&lhs, char c) {
+  if (!lhs.concat(c)) lhs.invalidate();
+  return static_cast<StringSumHelper &&>(lhs);
+}
+
+StringSumHelper && operator + (StringSumHelper &&lhs, unsigned char num) {
+  if (!lhs.concat(num)) lhs.invalidate();
+  return static_cast<StringSumHelper &&>(lhs);
+}
+
+StringSumHelper && operator + (StringSumHelper &&lhs, int num) {
+  if (!lhs.concat(num)) lhs.invalidate();
+  return static_cast<StringSumHelper &&>(lhs);
+}
+
+StringSumHelper && operator + (StringSumHelper &&lhs, unsigned int num) {
+  if (!lhs.concat(num)) lhs.invalidate();
+  return static_cast<StringSumHelper &&>(lhs);
+}
+
+StringSumHelper && operator + (StringSumHelper &&lhs, long num) {
+  if (!lhs.concat(num)) lhs.invalidate();
+  return static_cast<StringSumHelper &&>(lhs);
+}
+
+StringSumHelper && operator + (StringSumHelper &&lhs, unsigned long num) {
+  if (!lhs.concat(num)) lhs.invalidate();
+  return static_cast<StringSumHelper &&>(lhs);
+}
+#endif
+
 /*********************************************/
 /*  Comparison                               */
 /*********************************************/
@@ -511,14 +668,14 @@ void String::replace(const String& find, const String& replace) {
     char *writeTo = buffer;
     while ((foundAt = strstr(readFrom, find.buffer)) != NULL) {
       unsigned int n = foundAt - readFrom;
-      memcpy(writeTo, readFrom, n);
+      memmove(writeTo, readFrom, n);
       writeTo += n;
       memcpy(writeTo, replace.buffer, replace.len);
       writeTo += replace.len;
       readFrom = foundAt + find.len;
       len += diff;
     }
-    strcpy(writeTo, readFrom);
+    memmove(writeTo, readFrom, strlen(readFrom) + 1);
   } else {
     unsigned int size = len; // compute size needed for result
     while ((foundAt = strstr(readFrom, find.buffer)) != NULL) {
@@ -560,7 +717,7 @@ void String::trim(void) {
   char *end = buffer + len - 1;
   while (isspace(*end) && end >= begin) end--;
   len = end + 1 - begin;
-  if (begin > buffer) memcpy(buffer, begin, len);
+  if (begin > buffer) memmove(buffer, begin, len);
   buffer[len] = 0;
 }
 
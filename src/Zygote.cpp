@@ -0,0 +1,233 @@
+/*
+  Zygote.cpp - Serve runs from pre-forked, initialised children
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "Zygote.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+namespace _sim {
+
+namespace {
+
+// The most a request's sketch path and options can take up.
+const size_t MAX_REQUEST_BYTES = 4096;
+// How long a client has to send its request once connected.
+const time_t REQUEST_TIMEOUT_S = 1;
+// How long to wait before forking again after a child died without taking
+// a request, so that one that always does can't spin the server.
+const useconds_t RESPAWN_DELAY_US = 100000;
+
+volatile sig_atomic_t stopping = 0;
+
+void
+stop_serving(int s __attribute__((unused))) {
+  stopping = 1;
+}
+
+void
+handle_stop_signals(void (*handler)(int)) {
+  struct sigaction action;
+  action.sa_handler = handler;
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = 0;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+}
+
+// Read a request off conn, or return false (closing any fds that came with
+// it) if it isn't one.
+bool
+receive_request(int conn, ZygoteRequest* request) {
+  char buf[MAX_REQUEST_BYTES];
+  char control[CMSG_SPACE(2 * sizeof(int))];
+  struct iovec iov;
+  iov.iov_base = buf;
+  iov.iov_len = sizeof(buf);
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  ssize_t len;
+  do {
+    len = recvmsg(conn, &msg, 0);
+  } while (len == -1 && errno == EINTR);
+
+  int fds[2];
+  size_t num_fds = 0;
+  struct cmsghdr* cmsg = (len > 0) ? CMSG_FIRSTHDR(&msg) : NULL;
+  if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+    num_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    memcpy(fds, CMSG_DATA(cmsg), num_fds * sizeof(int));
+  }
+  if (len <= 0 || buf[len - 1] != 0 || num_fds != 2 || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+    for (size_t i = 0; i < num_fds; i++) {
+      close(fds[i]);
+    }
+    return false;
+  }
+
+  request->client_fd = fds[0];
+  request->updates_fd = fds[1];
+  request->sketch = buf;
+  for (const char* arg = buf + strlen(buf) + 1; arg < buf + len; arg += strlen(arg) + 1) {
+    request->args.push_back(arg);
+  }
+  return true;
+}
+
+// In a newly forked child: wait for the next connection and read the request
+// off it.
+void
+take_request(int listen_fd, int taken_fd, pid_t server, ZygoteRequest* request) {
+  // Go with the server rather than wait for a connection that can't come.
+  prctl(PR_SET_PDEATHSIG, SIGTERM);
+  if (getppid() != server) {
+    exit(EXIT_FAILURE);
+  }
+  int conn;
+  do {
+    conn = accept(listen_fd, NULL, NULL);
+  } while (conn == -1 && errno == EINTR && !stopping);
+  if (conn == -1) {
+    exit(stopping ? EXIT_SUCCESS : EXIT_FAILURE);
+  }
+  close(listen_fd);
+  prctl(PR_SET_PDEATHSIG, 0);
+  handle_stop_signals(SIG_DFL);
+  signal(SIGCHLD, SIG_DFL);
+
+  // The server waits for the reply to fork the next child, so a client
+  // mustn't be able to hold it up.
+  struct timeval timeout;
+  timeout.tv_sec = REQUEST_TIMEOUT_S;
+  timeout.tv_usec = 0;
+  setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  request->conn = conn;
+  request->taken_fd = taken_fd;
+  if (!receive_request(conn, request)) {
+    zygote_reply(request, "bad request");
+    exit(EXIT_FAILURE);
+  }
+}
+
+} // namespace
+
+void
+zygote_serve(const char* path, ZygoteRequest* request) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Zygote socket path too long: %s\n", path);
+    exit(EXIT_FAILURE);
+  }
+  strcpy(addr.sun_path, path);
+  int listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  unlink(path);
+  if (listen_fd == -1 || bind(listen_fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == -1 ||
+      listen(listen_fd, SOMAXCONN) == -1) {
+    fprintf(stderr, "Couldn't listen at %s: %s\n", path, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  handle_stop_signals(stop_serving);
+  // Runs are never waited for, so don't leave them as zombies.
+  signal(SIGCHLD, SIG_IGN);
+
+  pid_t server = getpid();
+  while (!stopping) {
+    // Each child has a pipe of its own, so that the server sees it close if
+    // the child dies before taking a request.
+    int taken[2];
+    if (pipe2(taken, O_CLOEXEC) == -1) {
+      perror("Couldn't make a zygote pipe");
+      break;
+    }
+    // Let the last child's run and its client go first, on a machine
+    // without a core to spare.
+    sched_yield();
+    pid_t child = fork();
+    if (child == 0) {
+      close(taken[0]);
+      take_request(listen_fd, taken[1], server, request);
+      return;
+    }
+    close(taken[1]);
+    if (child == -1) {
+      perror("Couldn't fork a zygote child");
+      close(taken[0]);
+      break;
+    }
+
+    char byte;
+    ssize_t n;
+    do {
+      n = read(taken[0], &byte, 1);
+    } while (n == -1 && errno == EINTR && !stopping);
+    close(taken[0]);
+    if (n != 1) {
+      if (stopping) {
+        kill(child, SIGTERM);
+      } else {
+        fprintf(stderr, "Zygote child %d exited before taking a request\n", static_cast<int>(child));
+        usleep(RESPAWN_DELAY_US);
+      }
+    }
+  }
+  close(listen_fd);
+  unlink(path);
+  exit(stopping ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+void
+zygote_reply(ZygoteRequest* request, const char* error) {
+  char reply[1024];
+  if (error) {
+    snprintf(reply, sizeof(reply), "error %s", error);
+  } else {
+    snprintf(reply, sizeof(reply), "ok %d", static_cast<int>(getpid()));
+  }
+  // A client that has already hung up, e.g. one checking the server is up,
+  // doesn't need telling.
+  if (send(request->conn, reply, strlen(reply), MSG_NOSIGNAL) == -1 && errno != EPIPE) {
+    perror("Couldn't reply to a zygote request");
+  }
+  close(request->conn);
+  request->conn = -1;
+
+  // The server can fork the next child now. Doing that any earlier would
+  // hold this one up on a machine without a core to spare, as the server
+  // would be woken to fork in the middle of it.
+  if (write(request->taken_fd, "", 1) != 1) {
+    perror("Couldn't tell the zygote a request was taken");
+  }
+  close(request->taken_fd);
+  request->taken_fd = -1;
+}
+
+}
@@ -0,0 +1,27 @@
+#ifndef BUDGET_H_
+#define BUDGET_H_
+
+#include <stdint.h>
+
+namespace _sim {
+
+// Per-run resource budgets, so that a runaway sketch can't hog a shared
+// host. A limit of zero means unlimited.
+void budget_set_cpu_limit(uint64_t us);
+void budget_set_virtual_limit(uint64_t us);
+// Fraction of one core the simulator may use, e.g. 0.5. Zero disables
+// throttling.
+void budget_set_cpu_share(double share);
+
+// Called periodically from the simulator. Sleeps if we are using more than
+// our CPU share, then checks the limits. Returns the name of the exceeded
+// budget ("cpu" or "virtual") and fills in the limit and usage, or returns
+// nullptr if the run is within budget.
+const char* budget_check(uint64_t arduino_us, uint64_t* limit, uint64_t* used);
+
+// CPU time used by the calling thread, in microseconds.
+uint64_t thread_cpu_micros();
+
+}
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef CLOCK_H_
+#define CLOCK_H_
+
+#include <stdint.h>
+#include <time.h>
+
+namespace _sim {
+
+// The monotonic clock, which real time throughout the simulator (pacing,
+// budgets, traces, time spent blocked) is measured against.
+inline uint64_t
+monotonic_nanos() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return static_cast<uint64_t>(t.tv_sec) * 1000000000 + t.tv_nsec;
+}
+
+inline uint64_t
+monotonic_micros() {
+  return monotonic_nanos() / 1000;
+}
+
+}
+
+#endif
@@ -12,12 +12,20 @@
 #include <random>
 #include "pins_arduino.h"
 #include "wiring.h"
+#include "Stats.h"
 
 #define NUM_PINS            31
 #define MUX_PINS            13
 #define NUM_LEDS            25
 #define NUM_ANALOG_PINS     12
 
+// Number of consecutive repeated input reads (with no outputs or changed
+// inputs in between) before the sketch is considered to be idle.
+#define IDLE_READS          64
+// Input sources tracked by the idle detector: mux channels, digital pins
+// and analog pins.
+#define IDLE_SOURCES        (MUX_PINS + 2 * NUM_PINS)
+
 enum PinState {
   GPIO_PIN_OUTPUT_LOW = 0,
   GPIO_PIN_OUTPUT_HIGH,
@@ -35,14 +43,17 @@ enum PinState {
 namespace _sim {
 
 // in Main.cpp:
-// Advance "arduino time" by this many micros. Call this from any Arduino/Esplora API.
-void increment_counter(int us);
+// Advance "arduino time" by this many micros. Call this from any Arduino/Esplora API,
+// saying which kind of API it is for the statistics.
+void increment_counter(int us, ApiKind kind = API_OTHER);
 // Force an immediate flush of pin/led state.
 void force_pin_update();
 // Timing where state is owned by Main.cpp.
 uint64_t get_elapsed_millis();
 uint64_t get_arduino_micros();
 uint64_t wall_time_micros();
+uint64_t real_time_micros();
+void set_speed(double factor);
 
 // in Device.cpp:
 bool has_exceeded_random_call_limit();
@@ -83,6 +94,8 @@ class _Device {
   std::atomic<uint64_t> _micros_elapsed;
   std::atomic<uint32_t> _micros_since_heartbeat;
   std::atomic<uint32_t> _us_since_sync;
+  // number of pins with a tone() countdown running
+  std::atomic<uint32_t> _countdowns_active;
 
 
   std::array<Pin, NUM_PINS> _pins;
@@ -93,6 +106,26 @@ class _Device {
   std::mutex _m_pins;
   std::mutex _m_mux;
   std::mutex _m_countdown;
+  std::mutex _m_idle;
+
+  // Idle detection state, only kept up once detect_idle() has been called. A
+  // read is only counted as a repeat if its source was already read, with
+  // the same value, in the current generation.
+  bool _detecting_idle = false;
+  uint32_t _idle_generation = 1;
+  uint32_t _idle_reads = 0;
+  std::array<uint32_t, IDLE_SOURCES> _idle_seen = {{0}};
+  std::array<int, IDLE_SOURCES> _idle_values = {{0}};
+
+  // Reaction timing, also guarded by _m_idle: whether the next output change
+  // should be timed, and when it happened.
+  bool _watching_outputs = false;
+  bool _output_changed = false;
+  uint64_t _output_change_us = 0;
+
+  // When a tone runs out part way through a time step, the Arduino time it
+  // actually ended, for the edge log. Zero otherwise.
+  uint64_t _expiry_us = 0;
 
   std::array<int, 5> _interrupt_map = {{0, 1, 2, 3, 7}};
   std::array<std::pair<int, int>, 7> _pwm_frequencies = {{ {3, 980}, {5, 490}, {6, 490}, {9,490}, {10,490}, {11,490}, {13,980} }};
@@ -101,9 +134,15 @@ class _Device {
   void set_input(int pin);
   void set_output(int pin);
   void process_countdown(uint32_t us);
+  void note_read(int source, int value);
+  void note_output(int pin);
+  void record_edge(int pin);
 
  public:
   _Device();
+  // Back to how the board powers up, e.g. for the next embedded sketch. Only
+  // while no sketch is running.
+  void reset();
   void set_pin_voltage(int pin, int value);
   double get_pin_voltage(int pin);
   void set_mux_voltage(int pin, double value);
@@ -137,6 +176,19 @@ class _Device {
   void set_pullup_digwrite(int pin, int value);
   bool digitalPinHasPWM(int p);
   bool isAnalogPin(int p);
+
+  // idle detection, see Main.cpp increment_counter. Off until detect_idle(),
+  // so that reads and writes don't pay for it unless it's wanted.
+  void detect_idle();
+  void note_activity();
+  bool is_idle();
+  // microseconds until the next tone countdown expires, or 0 if none
+  uint32_t next_countdown();
+
+  // reaction timing: after watch_outputs(), output_changed() reports the
+  // Arduino time of the first visible output change
+  void watch_outputs();
+  bool output_changed(uint64_t* us);
 };
 
 
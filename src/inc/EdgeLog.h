@@ -0,0 +1,37 @@
+#ifndef EDGE_LOG_H_
+#define EDGE_LOG_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+namespace _sim {
+
+// Every change to an output the client can see, with the Arduino time it
+// happened. Pin snapshots are only sampled every update period, so a 5 ms
+// blink can fall between two of them; the edge log catches it without a
+// snapshot per change. Edges are sent in batches as arduino_edges updates:
+//
+//   { "start_us": 1020, "edges": [[0,13,1], [5000,13,0], [12,5,2,8,2040]] }
+//
+// Each edge is [us since the previous edge (or start_us), pin, state] as in
+// arduino_pins "p", followed by the PWM high time and period if the state is
+// PWM.
+
+// Set by edge_log_start. Checked before recording, so that the Device
+// doesn't pay for a call when edges aren't wanted.
+extern bool edge_logging;
+// Edges per batch, beyond which the log should be sent without waiting for
+// the next update.
+const size_t EDGE_BATCH = 1024;
+
+void edge_log_start();
+void edge_log_record(uint64_t us, int pin, int state, uint32_t pwm_high_time, uint32_t pwm_period);
+size_t edge_log_size();
+// Encode the logged edges as the data of an arduino_edges update, appending
+// to json, and clear the log.
+void edge_log_take(std::string* json);
+
+}
+
+#endif
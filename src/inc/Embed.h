@@ -0,0 +1,37 @@
+#ifndef EMBED_H_
+#define EMBED_H_
+
+#include <stdint.h>
+#include <string>
+
+namespace _sim {
+
+// In Main.cpp: running the sketch inside another program, for the C API in
+// esplora_sim.h. The sketch runs in lockstep mode on a Fiber, which yields
+// back to the program between runs rather than waiting on a client pipe.
+
+// Start the sketch with these entry points, returning once it's waiting at
+// Arduino time zero, or false if there's no memory for its stack.
+bool embed_start(void (*setup)(), void (*loop)());
+// Let the sketch run us further, returning once it has yielded again or
+// finished.
+void embed_run_for(uint64_t us);
+bool embed_finished();
+uint64_t embed_loops();
+uint64_t embed_api_calls();
+// End the sketch, wherever it is.
+void embed_stop();
+// Once the sketch has ended and been unloaded, put the simulator back as it
+// was before embed_start, so that the next sketch starts clean.
+void embed_reset();
+
+// In Embed.cpp: dlopen the sketch at path and find its setup() and loop(),
+// or return null with error saying why.
+void* embed_load_sketch(const char* path, void (**setup)(), void (**loop)(), std::string* error);
+
+// In WString.cpp: give the String pool's cached blocks back to malloc.
+void string_pool_clear();
+
+}
+
+#endif
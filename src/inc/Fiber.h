@@ -0,0 +1,90 @@
+#ifndef FIBER_H_
+#define FIBER_H_
+
+#include <stddef.h>
+
+// The hand written switch is for x86-64. Building with
+// -DESPLORA_FIBER_UCONTEXT uses swapcontext there too, as everywhere else.
+#if defined(__x86_64__) && !defined(ESPLORA_FIBER_UCONTEXT)
+#define ESPLORA_FIBER_ASM 1
+#else
+#include <ucontext.h>
+#endif
+
+#ifdef ESPLORA_FIBER_ASM
+// Save the callee-saved registers on the current stack and its stack pointer
+// in *save_sp, then carry on from load_sp, which was saved the same way. See
+// Fiber.cpp.
+extern "C" void esplora_fiber_switch(void** save_sp, void* load_sp);
+#endif
+
+namespace _sim {
+
+// A function running on its own stack, which it can yield from and be
+// resumed into on the same thread, e.g. the sketch, which yields whenever it
+// has to wait (see Main.cpp). A switch only saves and restores the registers a function call
+// has to preserve, so it costs about as much as a few calls.
+class Fiber {
+ public:
+  Fiber();
+  ~Fiber();
+  // Set up entry(arg) to run on a new stack of stack_bytes, with a guard page
+  // below it, the first time the fiber is resumed. Returns false if the stack
+  // can't be mapped. Once entry returns the fiber is finished, and can be
+  // started again.
+  bool start(void (*entry)(void*), void* arg, size_t stack_bytes);
+  bool
+  finished() const {
+    return _finished;
+  }
+
+  // Switch into the fiber, returning when it yields or finishes. A finished
+  // fiber's stack is freed, so it mustn't be resumed again until restarted.
+  void
+  resume() {
+#ifdef ESPLORA_FIBER_ASM
+    esplora_fiber_switch(&_caller_sp, _sp);
+#else
+    swapcontext(&_caller, &_context);
+#endif
+    if (_finished) {
+      free_stack();
+    }
+  }
+
+  // From inside the fiber, switch back to whoever resumed it.
+  void
+  yield() {
+#ifdef ESPLORA_FIBER_ASM
+    esplora_fiber_switch(&_sp, _caller_sp);
+#else
+    swapcontext(&_context, &_caller);
+#endif
+  }
+
+ private:
+  Fiber(const Fiber&);
+  Fiber& operator=(const Fiber&);
+
+  // Where every fiber starts: runs its entry, then switches out for the last
+  // time.
+  static void run(void* fiber);
+  void free_stack();
+
+#ifdef ESPLORA_FIBER_ASM
+  void* _sp;
+  void* _caller_sp;
+#else
+  ucontext_t _context;
+  ucontext_t _caller;
+#endif
+  void (*_entry)(void*);
+  void* _arg;
+  bool _finished;
+  char* _stack;
+  size_t _map_bytes;
+};
+
+}
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef PROFILE_H_
+#define PROFILE_H_
+
+#include <stdint.h>
+#include <string>
+
+namespace _sim {
+
+// Opt-in profiler that charges simulated time to the code that asked for it.
+// Each charge records the call stack above increment_counter, so time is
+// attributed to the Arduino API function (e.g. analogRead) and to its callers
+// in the sketch. Time the simulator charges itself, for setup() and each
+// loop(), is shown as "(simulator)". Stacks are symbolized when the profile
+// is written.
+void profile_start(const char* prefix);
+// Called from increment_counter, by way of pass_time, with the Arduino time
+// being charged and the return address into the API function charging it,
+// from which the stack is recorded. Null is the simulator charging itself.
+void profile_charge(uint64_t us, void* api);
+// Write <prefix>.flat, a flat profile by function and by call site, and
+// <prefix>.folded, folded stacks for flame graph tools.
+void profile_write();
+
+// Name of the function containing a return address, e.g. "analogRead(int)".
+std::string symbol_name(void* return_address);
+
+}
+
+#endif
@@ -0,0 +1,128 @@
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace _sim {
+
+// What kind of Arduino API charged the time passed to increment_counter.
+enum ApiKind {
+  API_OTHER = 0,
+  API_PIN,
+  API_ANALOG,
+  API_TONE,
+  API_TIME,
+  API_DELAY,
+  API_RANDOM,
+  API_SERIAL,
+  API_ESPLORA,
+  API_KINDS,
+};
+
+// Log-linear histogram in the style of HdrHistogram. Values below
+// HIST_SUB_BUCKETS are exact, and each power of two above that is split into
+// HIST_SUB_BUCKETS buckets, so every value is recorded to within 1/16.
+const int HIST_SUB_BITS = 4;
+const int HIST_SUB_BUCKETS = 1 << HIST_SUB_BITS;
+const int HIST_BUCKETS = (64 - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS;
+
+struct Histogram {
+  uint64_t counts[HIST_BUCKETS];
+  uint64_t count;
+  uint64_t sum;
+  uint64_t max;
+};
+
+// Counters describing what the simulator has been doing. They are only ever
+// written by the sketch thread, so they are bumped with a relaxed atomic load
+// and store rather than a locked read-modify-write, and can be read from
+// anywhere with stat_get. The builtins are used directly because they stay
+// inline in unoptimised builds, where std::atomic's member calls don't.
+struct Stats {
+  uint64_t api_calls[API_KINDS];
+  // Steps of at most MAX_SLEEP that increment_counter advances time in.
+  uint64_t steps;
+  uint64_t updates;
+  uint64_t update_bytes;
+  // Updates the consumer wasn't ready for, see UpdateQueue.h: how many were
+  // queued, how many of those a newer snapshot replaced, how many are
+  // queued now and at most, and real time spent blocked on a full queue.
+  uint64_t updates_queued;
+  uint64_t updates_conflated;
+  uint64_t update_queue_depth;
+  uint64_t update_queue_max_depth;
+  uint64_t update_blocked_us;
+  // Output changes recorded in the edge log, see EdgeLog.h.
+  uint64_t edges;
+  uint64_t events;
+  uint64_t events_rejected;
+  // Real time spent waiting for the client to resume us.
+  uint64_t suspend_us;
+  // Largest amount real-time mode has fallen behind the wall clock.
+  uint64_t max_lag_us;
+  // Arduino String storage, see WString.cpp: buffers requested, those
+  // served from the pool's free lists, and bytes in use and cached.
+  uint64_t string_allocs;
+  uint64_t string_pool_hits;
+  uint64_t string_bytes;
+  uint64_t string_cached_bytes;
+  // Arduino time between the starts of consecutive loop() calls.
+  Histogram loop_period_us;
+  // Arduino time from an input event being applied to the next output change.
+  Histogram reaction_us;
+};
+
+extern Stats _stats;
+
+inline uint64_t
+stat_get(const uint64_t& counter) {
+  return __atomic_load_n(&counter, __ATOMIC_RELAXED);
+}
+
+inline void
+stat_add(uint64_t& counter, uint64_t n = 1) {
+  __atomic_store_n(&counter, __atomic_load_n(&counter, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+inline void
+stat_sub(uint64_t& counter, uint64_t n) {
+  __atomic_store_n(&counter, __atomic_load_n(&counter, __ATOMIC_RELAXED) - n, __ATOMIC_RELAXED);
+}
+
+inline void
+stat_set(uint64_t& counter, uint64_t n) {
+  __atomic_store_n(&counter, n, __ATOMIC_RELAXED);
+}
+
+inline void
+stat_max(uint64_t& counter, uint64_t n) {
+  if (n > __atomic_load_n(&counter, __ATOMIC_RELAXED)) {
+    __atomic_store_n(&counter, n, __ATOMIC_RELAXED);
+  }
+}
+
+inline int
+hist_bucket(uint64_t value) {
+  if (value < HIST_SUB_BUCKETS) {
+    return value;
+  }
+  int shift = 63 - __builtin_clzll(value) - HIST_SUB_BITS;
+  return (shift + 1) * HIST_SUB_BUCKETS + (value >> shift) - HIST_SUB_BUCKETS;
+}
+
+inline void
+stat_record(Histogram& hist, uint64_t value) {
+  stat_add(hist.counts[hist_bucket(value)]);
+  stat_add(hist.count);
+  stat_add(hist.sum, value);
+  stat_max(hist.max, value);
+}
+
+// Write the counters as a JSON object. lag_us is how far Arduino time is
+// currently behind the wall clock (negative if ahead).
+void stats_to_json(char* buf, size_t size, int64_t lag_us);
+
+}
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef TIMELINE_H_
+#define TIMELINE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+namespace _sim {
+
+// Columnar history of the pin outputs and mux inputs, for answering
+// questions like "what were the pins at t" or "every change to pin 5
+// between t0 and t1" without scanning ___device_updates. See
+// TimelineReader.h for reading one.
+//
+// Each pin and each mux channel is a series of (Arduino us, value) changes,
+// stored in blocks of up to TIMELINE_BLOCK_CHANGES. A block is a set of
+// columns: the times as varint deltas from the block's first change, then
+// for pins the states as varints and the PWM high times and periods as
+// zigzag varint deltas, or for mux channels the voltages in microvolts as
+// zigzag varint deltas. Each block starts afresh, so it can be decoded on
+// its own. The index at the end of the file has an entry per block:
+//
+//   header   "ESPTL\0\0\1", then u32 pins, u32 mux channels
+//   blocks
+//   index    TimelineIndexEntry per block
+//   footer   u64 index offset, u64 index entries, "ESPTLEND"
+//
+// All integers are little endian. The index is only written by
+// timeline_close, so a run that crashes leaves a file without one.
+const char TIMELINE_MAGIC[8] = { 'E', 'S', 'P', 'T', 'L', 0, 0, 1 };
+const char TIMELINE_END_MAGIC[8] = { 'E', 'S', 'P', 'T', 'L', 'E', 'N', 'D' };
+const size_t TIMELINE_HEADER_BYTES = 16;
+const size_t TIMELINE_FOOTER_BYTES = 24;
+const size_t TIMELINE_BLOCK_CHANGES = 256;
+
+// Series 0 to pins - 1 are the pins, followed by the mux channels.
+struct TimelineIndexEntry {
+  uint32_t series;
+  uint32_t changes;
+  uint64_t first_us;
+  uint64_t last_us;
+  uint64_t offset;
+  uint64_t nbytes;
+};
+
+inline void
+put_varint(std::string* out, uint64_t value) {
+  while (value >= 0x80) {
+    out->push_back(static_cast<char>(value | 0x80));
+    value >>= 7;
+  }
+  out->push_back(static_cast<char>(value));
+}
+
+// Returns false if the varint runs past end.
+inline bool
+get_varint(const uint8_t** p, const uint8_t* end, uint64_t* value) {
+  uint64_t result = 0;
+  for (int shift = 0; *p < end && shift < 64; shift += 7) {
+    uint8_t byte = *(*p)++;
+    result |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      *value = result;
+      return true;
+    }
+  }
+  return false;
+}
+
+inline uint64_t
+zigzag(int64_t value) {
+  return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+inline int64_t
+unzigzag(uint64_t value) {
+  return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+// Writing, from the simulator. Set by timeline_open, and checked before
+// recording so that the Device doesn't pay for a call when it's off.
+extern bool timeline_recording;
+// Closes any timeline already open first.
+bool timeline_open(const char* path);
+// Record a pin's state or a mux channel's voltage. Repeats of the current
+// value are ignored, and a change at the same time as the last replaces it.
+void timeline_pin(uint64_t us, int pin, int state, uint32_t pwm_high_time, uint32_t pwm_period);
+void timeline_mux(uint64_t us, int channel, double voltage);
+// Write out the partly filled blocks and the index.
+void timeline_close();
+
+}
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef TIMELINE_READER_H_
+#define TIMELINE_READER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include "Timeline.h"
+
+namespace _sim {
+
+struct TimelinePin {
+  uint64_t us;
+  int state;
+  uint32_t pwm_high_time;
+  uint32_t pwm_period;
+};
+
+struct TimelineMux {
+  uint64_t us;
+  double voltage;
+};
+
+// Reads a file written with timeline_open. Opening reads only the header
+// and the index, and each query decodes just the blocks that cover it.
+class TimelineReader {
+ public:
+  TimelineReader();
+  ~TimelineReader();
+  // On failure, returns false and error() says why.
+  bool open(const char* path);
+  const std::string& error() const { return _error; }
+
+  int pins() const { return _pins; }
+  int mux_channels() const { return _mux_channels; }
+  // The time of the last change in the file.
+  uint64_t end_us() const { return _end_us; }
+
+  // The pin's state at us, i.e. as of its last change at or before then.
+  // Before its first change a pin is OUTPUT_LOW, with us 0.
+  TimelinePin pin_at(int pin, uint64_t us);
+  // Every change to the pin from from_us to to_us inclusive.
+  std::vector<TimelinePin> pin_changes(int pin, uint64_t from_us, uint64_t to_us);
+  // As above for a mux channel, whose voltage is NAN before it was first set.
+  TimelineMux mux_at(int channel, uint64_t us);
+  std::vector<TimelineMux> mux_changes(int channel, uint64_t from_us, uint64_t to_us);
+
+  // How many blocks the queries have decoded, out of blocks().
+  size_t blocks_read() const { return _blocks_read; }
+  size_t blocks() const { return _nblocks; }
+
+ private:
+  struct Change {
+    uint64_t us;
+    int64_t values[3];
+  };
+
+  bool fail(const char* why);
+  bool read_at(uint64_t offset, void* buf, size_t nbytes);
+  bool decode(uint32_t series, const TimelineIndexEntry& entry, std::vector<Change>* changes);
+  // The changes to a series from from_us to to_us, plus the last one before
+  // from_us if with_previous is set.
+  std::vector<Change> changes(uint32_t series, uint64_t from_us, uint64_t to_us, bool with_previous);
+
+  int _fd;
+  std::string _error;
+  int _pins;
+  int _mux_channels;
+  uint64_t _end_us;
+  // Each series' blocks, in time order.
+  std::vector<std::vector<TimelineIndexEntry> > _index;
+  size_t _nblocks;
+  size_t _blocks_read;
+  std::vector<uint8_t> _block;
+};
+
+}
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdint.h>
+
+namespace _sim {
+
+// What a trace record is about.
+enum TraceKind {
+  TRACE_SETUP = 0,
+  TRACE_LOOP,
+  // An increment_counter call, named after the API function that made it.
+  TRACE_API,
+  // Waiting for the client to resume us in fast mode.
+  TRACE_SUSPEND,
+  // Sleeping to keep real-time mode in step with the wall clock.
+  TRACE_SLEEP,
+  // Real-time mode jumping Arduino time forward to catch up with the wall clock.
+  TRACE_CATCH_UP,
+  TRACE_CLIENT_EVENT,
+  TRACE_UPDATE,
+  TRACE_KINDS,
+};
+
+// Low overhead tracer. Each thread records into its own ring buffer, which
+// keeps the most recent records, and trace_write dumps them all in Chrome
+// trace JSON (chrome://tracing, ui.perfetto.dev) against both wall time and
+// Arduino time.
+void trace_start(const char* path);
+// Spans. where is a return address naming the span, for TRACE_API.
+void trace_begin(TraceKind kind, void* where = nullptr, uint32_t arg = 0);
+void trace_end(TraceKind kind);
+// Point events, arg is e.g. a byte count.
+void trace_instant(TraceKind kind, uint32_t arg);
+void trace_write();
+
+}
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef UPDATE_QUEUE_H_
+#define UPDATE_QUEUE_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <deque>
+#include <string>
+
+namespace _sim {
+
+// The "type" of each update the simulator writes.
+enum UpdateType {
+  // Snapshots of state, where a newer one supersedes any still queued.
+  UPDATE_PINS = 0,
+  UPDATE_HEARTBEAT,
+  UPDATE_RANDOM_STATE,
+  UPDATE_SIM_STATS,
+  // Events, which are never dropped.
+  UPDATE_HELLO,
+  UPDATE_BYE,
+  UPDATE_ACK,
+  UPDATE_MARKER_FAILURE,
+  UPDATE_REACTION,
+  UPDATE_BUDGET_EXCEEDED,
+  UPDATE_EDGES,
+  UPDATE_STEP_DONE,
+  UPDATE_TYPES,
+};
+
+// The type's name in the JSON, e.g. "arduino_pins".
+const char* update_type_name(UpdateType type);
+// The type with the given name, or UPDATE_TYPES if there isn't one.
+UpdateType update_type_named(const char* name, size_t length);
+
+inline bool
+is_snapshot(UpdateType type) {
+  return type <= UPDATE_SIM_STATS;
+}
+
+// Bounded output queue in front of an updates fd, so that a GUI or marker
+// that falls behind doesn't block the sketch thread. Updates are written
+// straight through while the consumer keeps up. Once it doesn't, they wait
+// in order in the queue, with a snapshot replacing any older one of the same
+// type. Only if the queue reaches its limit with updates that can't be
+// dropped does the writer block.
+class UpdateQueue {
+ public:
+  UpdateQueue();
+  void open(int fd, size_t max_bytes);
+  int fd() const { return _fd; }
+  void write(const void* buf, size_t count, UpdateType type);
+  // Write whatever the consumer has room for without blocking.
+  void flush();
+  // Whether any updates are waiting, i.e. whether to poll the fd for POLLOUT.
+  bool pending() const { return !_queue.empty(); }
+  // Block until everything queued has been written, e.g. before exiting.
+  void drain();
+
+ private:
+  struct Update {
+    std::string data;
+    UpdateType type;
+  };
+
+  ssize_t write_some(const char* data, size_t count);
+  void enqueue(const char* data, size_t count, size_t written, UpdateType type);
+  void pop_front();
+  void discard();
+
+  int _fd;
+  // The fd's flags before O_NONBLOCK was added, restored to drain at exit.
+  int _original_flags;
+  size_t _max_bytes;
+  std::deque<Update> _queue;
+  // How much of the front update has been written. A partly written update
+  // has to be finished, so it is never conflated.
+  size_t _front_written;
+  size_t _queued_bytes;
+};
+
+}
+
+#endif
@@ -0,0 +1,117 @@
+#ifndef UPDATE_RING_H_
+#define UPDATE_RING_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include "UpdateQueue.h"
+
+namespace _sim {
+
+// Updates in a fixed size memory mapped file, for any number of local
+// readers to tail at their own pace. The simulator is the only writer and
+// never waits for a reader: once the ring is full, each new record
+// overwrites the oldest. A reader that falls that far behind sees a jump in
+// the sequence numbers and carries on from the oldest record left.
+//
+//   header   UpdateRingHeader, 64 bytes
+//   records  capacity bytes, each an UpdateRecordHeader and the update,
+//            padded to a multiple of 16
+//
+// A record never wraps around the end. If the next one doesn't fit, the rest
+// of the ring is filled with a padding record and it goes at the start.
+// head and tail count bytes ever written, so a record starts at
+// position % capacity. Before overwriting anything the writer moves tail
+// past it, and only once a record is complete does it move head. A reader
+// copies a record out and then checks that tail hasn't passed it.
+const char UPDATE_RING_MAGIC[8] = { 'E', 'S', 'P', 'R', 'I', 'N', 'G', 1 };
+const size_t UPDATE_RING_MIN_BYTES = 64 * 1024;
+const uint16_t UPDATE_RECORD_PADDING = 0xffff;
+
+struct UpdateRingHeader {
+  char magic[8];
+  // Bytes of records, a power of two.
+  uint64_t capacity;
+  // The end of the last complete record.
+  uint64_t head;
+  // The start of the oldest record that is still intact.
+  uint64_t tail;
+  // Bumped each time a run reuses the file, so that readers start over.
+  uint32_t run;
+  // Set by the writer once it has written its last record.
+  uint32_t closed;
+  uint32_t pad[6];
+};
+
+struct UpdateRecordHeader {
+  // Counts from 1, and is 0 for padding.
+  uint64_t seq;
+  uint32_t size;
+  // An UpdateType, or UPDATE_RECORD_PADDING.
+  uint16_t type;
+  uint16_t unused;
+};
+
+static_assert(sizeof(UpdateRingHeader) == 64, "the records follow the header");
+static_assert(sizeof(UpdateRecordHeader) == 16, "records are 16 byte aligned");
+
+inline uint64_t
+update_record_bytes(uint32_t size) {
+  return (sizeof(UpdateRecordHeader) + size + 15) & ~static_cast<uint64_t>(15);
+}
+
+// The simulator's end.
+class UpdateRing {
+ public:
+  UpdateRing();
+  // Create or reuse the file at path with room for capacity bytes of
+  // records, rounded up to a power of two. Readers that have the file open
+  // from an earlier run start over. Returns false on failure.
+  bool open(const char* path, size_t capacity);
+  // An update bigger than the ring can't be written, but still takes a
+  // sequence number so that readers see it was lost.
+  void write(const void* buf, size_t count, UpdateType type);
+  void close();
+
+ private:
+  void append(uint64_t seq, uint16_t type, const void* buf, uint32_t size);
+
+  UpdateRingHeader* _header;
+  char* _records;
+  uint64_t _capacity;
+  uint64_t _head;
+  uint64_t _tail;
+  uint64_t _seq;
+};
+
+// A reader's end, e.g. in build/ringtail.
+class UpdateRingReader {
+ public:
+  UpdateRingReader();
+  ~UpdateRingReader();
+  // Start from the oldest record still in the ring, or if from_oldest isn't
+  // set, from the next one written. Returns false on failure.
+  bool open(const char* path, bool from_oldest);
+  // Copy the next record into data and type, returning false if there isn't
+  // one yet. Records lost to overruns are added to lost().
+  bool next(std::string* data, UpdateType* type);
+  // Whether the writer has finished, so once next() returns false there will
+  // be no more. A new run with a different capacity also ends this one.
+  bool closed() const;
+  uint64_t lost() const { return _lost; }
+
+ private:
+  const UpdateRingHeader* _header;
+  const char* _records;
+  size_t _map_bytes;
+  uint64_t _capacity;
+  uint32_t _run;
+  bool _stale;
+  uint64_t _position;
+  uint64_t _next_seq;
+  uint64_t _lost;
+};
+
+}
+
+#endif
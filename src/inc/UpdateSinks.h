@@ -0,0 +1,62 @@
+#ifndef UPDATE_SINKS_H_
+#define UPDATE_SINKS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <poll.h>
+#include "UpdateQueue.h"
+#include "UpdateRing.h"
+
+namespace _sim {
+
+// Where updates go. The primary sink is GROK_UPDATES_PIPE (or the
+// ___device_updates file). It gets every update, and its client is the one
+// that resumes us in fast mode. GROK_UPDATE_SINKS adds more for other
+// consumers, e.g. a marker and a recorder alongside the GUI. Sinks are
+// separated by ';', and each is a list of comma separated options:
+//
+//   fd=N or file=PATH  where to write, N being an open file descriptor
+//   ring=PATH          or into an UpdateRing mapped from PATH, which any
+//                      number of readers can follow, and which never blocks
+//   ring_kb=N          the ring's size (default 4096)
+//   types=A+B+...      only updates of these types, e.g. arduino_pins
+//   pins=N+N+...       only pin snapshots where one of these pins changed
+//   period_ms=N        at most one pin snapshot this often, at least 1
+//                      (default 20)
+//   queue_kb=N         how much may queue before we block (default 1024)
+//
+// e.g. GROK_UPDATE_SINKS="file=run.jsonl;fd=5,types=arduino_pins+arduino_ack,pins=5+9+10,period_ms=100"
+//
+// Each update is encoded once and the same bytes are written to every sink
+// that wants it, each through its own UpdateQueue or UpdateRing.
+const int MAX_SINKS = 8;
+
+// A set of sinks, by bit. The primary sink is bit 0.
+typedef uint32_t SinkSet;
+const SinkSet PRIMARY_SINK = 1;
+const SinkSet ALL_SINKS = (1u << MAX_SINKS) - 1;
+
+// Set up the primary sink on fd and any others from GROK_UPDATE_SINKS,
+// exiting if they can't be. period_us is the default pin snapshot period.
+void update_sinks_open(int primary_fd, uint64_t period_us);
+// How often pin state needs sampling: the shortest period of any sink.
+uint64_t update_sinks_period_us();
+// The sinks due a snapshot of this pin state: those subscribed to pin
+// updates whose pins have changed since their last snapshot and whose
+// period has passed, unless force is set. They are then counted as sent.
+SinkSet update_sinks_pins_due(const int* pins, const int* pwm_high_time, const int* pwm_period, uint64_t now_us,
+                              bool force);
+// Write an update to those of sinks that subscribe to its type, returning
+// the ones it went to.
+SinkSet update_sinks_write(SinkSet sinks, UpdateType type, const void* buf, size_t count);
+// Write whatever queued updates the consumers have room for.
+void update_sinks_flush();
+// Fill in a POLLOUT pollfd for each sink with updates queued, returning how
+// many. pfds must have room for MAX_SINKS.
+int update_sinks_poll_fds(struct pollfd* pfds);
+// Write everything still queued, then close every sink.
+void update_sinks_close();
+
+}
+
+#endif
@@ -33,7 +33,7 @@
 // dramatically increase performance and memory (RAM) efficiency, typically
 // with little or no increase in code size.
 //     -felide-constructors
-//     -std=c++0x
+//     -std=c++11
 
 class __FlashStringHelper;
 #define F(string_literal) (reinterpret_cast<__FlashStringHelper *>(PSTR(string_literal)))
@@ -59,7 +59,7 @@ public:
   // be false).
   String(const char *cstr = "");
   String(const String &str);
-  #ifdef __GXX_EXPERIMENTAL_CXX0X__
+  #if __cplusplus >= 201103L
   String(String &&rval);
   String(StringSumHelper &&rval);
   #endif
@@ -83,7 +83,7 @@ public:
   // marked as invalid ("if (s)" will be false).
   String & operator = (const String &rhs);
   String & operator = (const char *cstr);
-  #ifdef __GXX_EXPERIMENTAL_CXX0X__
+  #if __cplusplus >= 201103L
   String & operator = (String &&rval);
   String & operator = (StringSumHelper &&rval);
   #endif
@@ -94,6 +94,9 @@ public:
   // is left unchanged).  if the argument is null or invalid, the 
   // concatenation is considered unsucessful.  
   unsigned char concat(const String &str);
+  #if __cplusplus >= 201103L
+  unsigned char concat(String &&rval);
+  #endif
   unsigned char concat(const char *cstr);
   unsigned char concat(char c);
   unsigned char concat(unsigned char c);
@@ -105,6 +108,9 @@ public:
   // if there's not enough memory for the concatenated value, the string
   // will be left unchanged (but this isn't signalled in any way)
   String & operator += (const String &rhs)  {concat(rhs); return (*this);}
+  #if __cplusplus >= 201103L
+  String & operator += (String &&rval)  {concat(static_cast<String &&>(rval)); return (*this);}
+  #endif
   String & operator += (const char *cstr)   {concat(cstr); return (*this);}
   String & operator += (char c)     {concat(c); return (*this);}
   String & operator += (unsigned char num)    {concat(num); return (*this);}
@@ -121,6 +127,18 @@ public:
   friend StringSumHelper & operator + (const StringSumHelper &lhs, unsigned int num);
   friend StringSumHelper & operator + (const StringSumHelper &lhs, long num);
   friend StringSumHelper & operator + (const StringSumHelper &lhs, unsigned long num);
+  #if __cplusplus >= 201103L
+  // a temporary on the left is appended to in place and passed on as an
+  // rvalue, so "a" + b + c builds one buffer and moves it into the result
+  friend StringSumHelper && operator + (StringSumHelper &&lhs, const String &rhs);
+  friend StringSumHelper && operator + (StringSumHelper &&lhs, const char *cstr);
+  friend StringSumHelper && operator + (StringSumHelper &&lhs, char c);
+  friend StringSumHelper && operator + (StringSumHelper &&lhs, unsigned char num);
+  friend StringSumHelper && operator + (StringSumHelper &&lhs, int num);
+  friend StringSumHelper && operator + (StringSumHelper &&lhs, unsigned int num);
+  friend StringSumHelper && operator + (StringSumHelper &&lhs, long num);
+  friend StringSumHelper && operator + (StringSumHelper &&lhs, unsigned long num);
+  #endif
 
   // comparison (only works w/ Strings and "strings")
   operator StringIfHelperType() const { return buffer ? &String::StringIfHelper : 0; }
@@ -178,19 +196,24 @@ public:
   long toInt(void) const;
 
 protected:
-  char *buffer;         // the actual char array
+  // strings this short are stored in sso rather than allocated
+  enum { SSO_CAPACITY = 15 };
+
+  char *buffer;         // the actual char array, sso or from the string pool
   unsigned int capacity;  // the array length minus one (for the '\0')
   unsigned int len;       // the String length (not counting the '\0')
   unsigned char flags;    // unused, for future features
+  char sso[SSO_CAPACITY + 1];
 protected:
   void init(void);
   void invalidate(void);
+  void release(void);
   unsigned char changeBuffer(unsigned int maxStrLen);
   unsigned char concat(const char *cstr, unsigned int length);
 
   // copy and move
   String & copy(const char *cstr, unsigned int length);
-  #ifdef __GXX_EXPERIMENTAL_CXX0X__
+  #if __cplusplus >= 201103L
   void move(String &rhs);
   #endif
 };
@@ -199,6 +222,9 @@ class StringSumHelper : public String
 {
 public:
   StringSumHelper(const String &s) : String(s) {}
+  #if __cplusplus >= 201103L
+  StringSumHelper(String &&s) : String(static_cast<String &&>(s)) {}
+  #endif
   StringSumHelper(const char *p) : String(p) {}
   StringSumHelper(char c) : String(c) {}
   StringSumHelper(unsigned char num) : String(num) {}
@@ -0,0 +1,40 @@
+#ifndef ZYGOTE_H_
+#define ZYGOTE_H_
+
+#include <string>
+#include <vector>
+
+namespace _sim {
+
+// Serving runs from a warm process, for -z. Rather than exec'ing the
+// simulator for each run, a client connects to a Unix socket and hands over
+// its pipes, and a child that was forked ahead of time, with the simulator
+// already loaded and initialised, takes the run from there.
+//
+// A request is one SOCK_SEQPACKET message: the path of the sketch's shared
+// object (empty for the sketch built in), then the run's options, each NUL
+// terminated, with the client events and device updates fds attached in that
+// order as SCM_RIGHTS. The reply is "ok PID", after which the run carries on
+// over those fds as usual, or "error MESSAGE".
+struct ZygoteRequest {
+  std::string sketch;
+  std::vector<std::string> args;
+  int client_fd;
+  int updates_fd;
+  // The connection the request came on, until it has been replied to, and
+  // the pipe to tell the server that it has.
+  int conn = -1;
+  int taken_fd = -1;
+};
+
+// Listen at path, keeping a child forked ahead to take the next request.
+// Only returns in that child, with its request. The server itself exits from
+// here on SIGINT or SIGTERM, or if it can't listen.
+void zygote_serve(const char* path, ZygoteRequest* request);
+// Say whether the run has started, i.e. error is null, and hang up. The
+// server only forks the next child once the last has replied.
+void zygote_reply(ZygoteRequest* request, const char* error);
+
+}
+
+#endif
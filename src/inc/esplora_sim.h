@@ -0,0 +1,67 @@
+#ifndef ESPLORA_SIM_H_
+#define ESPLORA_SIM_H_
+
+/*
+  The simulator as a library, build/libesplora-sim.so, for driving a sketch
+  from inside a test harness without a process, pipes or JSON in between.
+
+  The sketch is a shared object linked against the library, e.g.
+  build/sketch.so from `make lib`. Once loaded, it runs in lockstep on a
+  fiber of the calling thread: Arduino time only advances inside
+  sim_run_for, which returns once the sketch has run exactly that far.
+  Inputs and state can be set and read between runs.
+
+  The simulator's state is global, so there can only be one per process at
+  a time: sim_create fails until the last has been destroyed. Destroying it
+  puts everything back as it was, so the next starts clean.
+*/
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SIM_PINS 31
+#define SIM_MUX_CHANNELS 13
+
+typedef struct sim sim;
+
+typedef struct sim_state {
+  // Arduino time, and how many loop()s and API calls it took to get here.
+  uint64_t us;
+  uint64_t loops;
+  uint64_t api_calls;
+  // Each pin's state, as in arduino_pins updates, and its PWM high time and
+  // period while it's a PWM output.
+  int32_t pins[SIM_PINS];
+  int32_t pwm_high_time[SIM_PINS];
+  int32_t pwm_period[SIM_PINS];
+  double mux[SIM_MUX_CHANNELS];
+  // Set once the sketch can't run any further, e.g. after a budget ran out.
+  int32_t finished;
+} sim_state;
+
+// NULL if there is already a simulator in this process.
+sim* sim_create(void);
+// Load the sketch in the shared object at path, and start it, waiting at
+// Arduino time zero. Returns 0, or -1 with sim_error saying why.
+int sim_load_sketch(sim* s, const char* path);
+// Drive a mux channel (e.g. 4 for the slider) with a voltage, or a pin with
+// a digital value, LOW (0 V) or anything else for HIGH (5 V). Returns -1 if
+// there's no such channel or pin.
+int sim_set_mux(sim* s, int channel, double voltage);
+int sim_set_pin(sim* s, int pin, int value);
+// Run the sketch for us of Arduino time. Returns 0, or 1 if the sketch has
+// finished and so didn't run the whole way.
+int sim_run_for(sim* s, uint64_t us);
+void sim_get_state(sim* s, sim_state* state);
+const char* sim_error(sim* s);
+// Stop the sketch wherever it is, and free the simulator.
+void sim_destroy(sim* s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -37,13 +37,13 @@ enum json_value_type {
 
 
 /**
- * A very simple linked list structure used for representing the elements in JSON objects and JSON
- * arrays.
+ * An element of a JSON object or JSON array. The elements of one value are stored contiguously in
+ * insertion order, and are also linked through \p next so that they can be walked as a list.
  **/
 struct json_value_list {
   char *key;                     //!< The key for a JSON object pair and \p NULL for a JSON array.
   struct json_value *value;      //!< The value for a JSON object pair and the value for a JSON array.
-  struct json_value_list *next;  //!< The next pointer for the linked list.
+  struct json_value_list *next;  //!< The next element, or \p NULL for the last one.
 };
 
 
@@ -55,9 +55,12 @@ struct json_value {
   union {
     bool boolean;                   //!< A Boolean value used for JSON \p true and \p false values.
     double number;                  //!< A 64-bit double-precision number used for JSON numbers.
-    struct json_value_list *pairs;  //!< A linked list of pairs. Used for JSON objects and arrays.
+    struct json_value_list *pairs;  //!< The elements of JSON objects and arrays, in one allocation.
     char *string;                   //!< A UTF-8 encoded string used for JSON strings.
   } as;                             //!< A union for storage of the underlying value of this JSON value.
+  uint32_t npairs;                  //!< The number of elements in \p as.pairs.
+  uint32_t pairs_capacity;          //!< The number of elements allocated for \p as.pairs.
+  uint32_t *index;                  //!< For objects with more than a few keys, a hash table of 1-based positions in \p as.pairs.
 };
 
 
@@ -129,7 +132,8 @@ json_value_set(struct json_value *object, const char *key, struct json_value *va
 
 /**
  * Sets a key/value pair in a JSON object. It is assumed that the key does not already exist in the
- * object. A copy of the input \p key is made, but the \p value is used directly.
+ * object; if it does, #json_value_get returns the value set last. A copy of the input \p key is
+ * made, but the \p value is used directly.
  *
  * \param[in,out] object The JSON object to set the key/value pair in. Must not be \p NULL.
  * \param[in] key The key to set. Must not be \p NULL.
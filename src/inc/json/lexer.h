@@ -55,6 +55,16 @@ lexer_consume_uint32(struct lexer *lex, uint32_t *number) __attribute__((nonnull
 void
 lexer_consume_ws(struct lexer *lex) __attribute__((nonnull(1)));
 
+/**
+ * Counts the bytes from the current position up to the next \p " or \p \\, which are the only
+ * bytes that end a run of plain characters inside a JSON string. Nothing is consumed.
+ *
+ * \param[in] lex The lexer instance. Must not be \p NULL.
+ * \return The length of the run, which is #lexer_nremaining if neither byte occurs.
+ **/
+size_t
+lexer_string_run(const struct lexer *lex) __attribute__((nonnull(1)));
+
 /**
  * \def lexer_consume
  * Unsafely consumes \p nbytes from the lexer \p lex.
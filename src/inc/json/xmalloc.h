@@ -1,10 +1,10 @@
 /**
  * \file
  *
- * Defines malloc wrappers #xcalloc and #xmalloc which when not running the test cases, are simply
- * #defined'd to \p calloc and \p malloc respectively. During testing, these functions can be
- * configured with the help of \p xmalloc_reset to return \p NULL (failed to alloc) after a certain
- * number of invocations.
+ * Defines malloc wrappers #xcalloc, #xmalloc and #xrealloc which when not running the test cases,
+ * are simply #defined'd to \p calloc, \p malloc and \p realloc respectively. During testing, these
+ * functions can be configured with the help of \p xmalloc_reset to return \p NULL (failed to alloc)
+ * after a certain number of invocations.
  **/
 
 /**
@@ -17,9 +17,14 @@
  * An alias to \p malloc which is customised during unit testing.
  **/
 
+/**
+ * \def xrealloc(ptr, nbytes)
+ * An alias to \p realloc which is customised during unit testing.
+ **/
+
 /**
  * \fn void xmalloc_reset(unsigned int fail_after_ncalls);
- * Configures the behaviour of #xcalloc and #xmalloc during unit testing.
+ * Configures the behaviour of #xcalloc, #xmalloc and #xrealloc during unit testing.
  **/
 
 #pragma once
@@ -29,8 +34,10 @@
 #ifdef CUSTOM_XMALLOC
   void *xcalloc(size_t count, size_t nbytes);
   void *xmalloc(size_t nbytes);
+  void *xrealloc(void *ptr, size_t nbytes);
   void  xmalloc_reset(unsigned int fail_after_ncalls);
 #else
   #define xcalloc(count, nbytes) calloc(count, nbytes)
   #define xmalloc(nbytes) malloc(nbytes)
+  #define xrealloc(ptr, nbytes) realloc(ptr, nbytes)
 #endif
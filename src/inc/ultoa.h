@@ -1,9 +1,28 @@
 #ifndef ULTOA_H_
 #define ULTOA_H_
 
+#include <stddef.h>
+
+// Big enough for any long in base 2, with a sign and the '\0'.
+#define FORMAT_BUFFER_SIZE (8 * sizeof(long) + 2)
+// Big enough for format_float with the given number of decimal places.
+#define FORMAT_FLOAT_BUFFER_SIZE(digits) (13 + (digits))
+
+// As in avr-libc: a radix from 2 to 36, lower case letters, and a sign only
+// in base 10 (other bases show the two's complement). An invalid radix
+// gives an empty string.
 char* ultoa( unsigned long __val, char* __s, int __radix );
 char* ltoa( long __val, char* __s, int __radix );
 char* itoa( int __val, char* __s, int __radix );
 char* utoa( unsigned int __val, char* __s, int __radix );
 
+// The formatters behind the above, which don't allocate. Each writes a
+// '\0' terminated string to out and returns its length.
+size_t format_unsigned(unsigned long value, char* out, int radix, bool upper = false);
+size_t format_signed(long value, char* out, int radix, bool upper = false);
+// Fixed point with the given number of decimal places, rounded the way the
+// AVR core's Print does it, including "nan", "inf" and "ovf" (beyond the
+// range of a 32 bit unsigned long).
+size_t format_float(double value, unsigned char digits, char* out);
+
 #endif
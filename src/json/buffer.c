@@ -7,6 +7,7 @@
 #include "buffer.h"
 #include "xmalloc.h"
 
+// The smallest allocation. Beyond this the buffer doubles, so appending is amortised O(1).
 #define GROW_NBYTES ((size_t)512)
 
 
@@ -20,16 +21,14 @@ _buffer_maybe_grow(struct buffer *const buffer, const size_t new_nbytes) {
     return true;
   }
 
-  size_t nbytes_allocd = buffer->nbytes_allocd;
-  while (nbytes_allocd < nbytes) {
-    nbytes_allocd += GROW_NBYTES;
+  size_t nbytes_allocd = buffer->nbytes_allocd ? 2 * buffer->nbytes_allocd : GROW_NBYTES;
+  if (nbytes_allocd < nbytes) {
+    nbytes_allocd = nbytes;
   }
-  char *tmp = xmalloc(nbytes_allocd);
+  char *tmp = xrealloc(buffer->data, nbytes_allocd);
   if (tmp == NULL) {
     return false;
   }
-  memcpy(tmp, buffer->data, buffer->nbytes_used);
-  free(buffer->data);
   buffer->data = tmp;
   buffer->nbytes_allocd = nbytes_allocd;
   return true;
@@ -129,15 +128,27 @@ buffer_append_printf(struct buffer *const buffer, const char *const format, ...)
     return STATUS_EINVAL;
   }
 
-  static char tmp[32*GROW_NBYTES];
+  // Format straight into the free space, and again if it turns out to be too small.
   va_list args;
   va_start(args, format);
-
-  int ret = vsnprintf(tmp, sizeof(tmp), format, args);
-  if (ret == -1 || ((size_t)ret) >= sizeof(tmp)) {
+  const size_t nbytes_free = buffer->nbytes_allocd - buffer->nbytes_used;
+  int ret = vsnprintf(buffer->data ? buffer->data + buffer->nbytes_used : NULL, nbytes_free, format, args);
+  va_end(args);
+  if (ret < 0) {
     return STATUS_BAD;
   }
-  return _buffer_append_n(buffer, tmp, (size_t)ret);
+
+  // vsnprintf needs room for a '\0' after the output.
+  if ((size_t)ret >= nbytes_free) {
+    if (!_buffer_maybe_grow(buffer, (size_t)ret + 1)) {
+      return STATUS_ENOMEM;
+    }
+    va_start(args, format);
+    vsnprintf(buffer->data + buffer->nbytes_used, (size_t)ret + 1, format, args);
+    va_end(args);
+  }
+  buffer->nbytes_used += (size_t)ret;
+  return STATUS_OK;
 }
 
 
@@ -172,5 +183,5 @@ buffer_reserve(struct buffer *const buffer, const size_t nbytes) {
     return STATUS_EINVAL;
   }
 
-  return _buffer_maybe_grow(buffer, nbytes);
+  return _buffer_maybe_grow(buffer, nbytes) ? STATUS_OK : STATUS_ENOMEM;
 }
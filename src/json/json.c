@@ -79,27 +79,56 @@ parse_array(struct lexer *const lex, struct buffer *const buffer) {
 }
 
 
+// Powers of ten that are exactly representable as doubles.
+static const double POWERS_OF_TEN[] = {
+  1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+
 static struct json_value *
 parse_number(struct lexer *const lex) {
   char buffer[3 + DBL_MANT_DIG - DBL_MIN_EXP + 1];
   const char *const start = lexer_upto(lex);
+  uint64_t mantissa = 0;     // The significant digits, while there are few enough to be exact.
+  unsigned int ndigits = 0;  // How many digits are in mantissa, not counting leading zeros.
+  int exponent = 0;          // The power of ten to scale mantissa by.
+  bool exact = true;         // Whether mantissa and exponent hold the number exactly.
+  bool negative = false;
   unsigned int count;
   char c = lexer_peek(lex);
 
   if (c == '-') {
+    negative = true;
     lexer_consume(lex, 1);
   }
-  while (lexer_nremaining(lex) != 0) {
-    c = lexer_peek(lex);
-    if (!isdigit(c)) {
-      break;
+  count = 0;
+  while (lexer_nremaining(lex) != 0 && isdigit(c = lexer_peek(lex))) {
+    if (ndigits < 19) {
+      mantissa = 10 * mantissa + (c - '0');
+      ndigits += (mantissa != 0);
+    }
+    else {
+      exact = false;
     }
     lexer_consume(lex, 1);
+    ++count;
+  }
+  if (count == 0) {
+    return NULL;
   }
   if (lexer_nremaining(lex) != 0 && lexer_peek(lex) == '.') {
     lexer_consume(lex, 1);
     count = 0;
-    while (lexer_nremaining(lex) != 0 && isdigit(lexer_peek(lex))) {
+    while (lexer_nremaining(lex) != 0 && isdigit(c = lexer_peek(lex))) {
+      if (ndigits < 19) {
+        mantissa = 10 * mantissa + (c - '0');
+        ndigits += (mantissa != 0);
+        --exponent;
+      }
+      else {
+        exact = false;
+      }
       lexer_consume(lex, 1);
       ++count;
     }
@@ -108,18 +137,25 @@ parse_number(struct lexer *const lex) {
     }
   }
   if (lexer_nremaining(lex) != 0 && (lexer_peek(lex) == 'e' || lexer_peek(lex) == 'E')) {
+    bool negative_exponent = false;
+    int explicit_exponent = 0;
     lexer_consume(lex, 1);
     if (lexer_nremaining(lex) != 0 && (lexer_peek(lex) == '+' || lexer_peek(lex) == '-')) {
+      negative_exponent = lexer_peek(lex) == '-';
       lexer_consume(lex, 1);
     }
     count = 0;
-    while (lexer_nremaining(lex) != 0 && isdigit(lexer_peek(lex))) {
+    while (lexer_nremaining(lex) != 0 && isdigit(c = lexer_peek(lex))) {
+      if (explicit_exponent < 10000) {
+        explicit_exponent = 10 * explicit_exponent + (c - '0');
+      }
       lexer_consume(lex, 1);
       ++count;
     }
     if (count == 0) {
       return NULL;
     }
+    exponent += negative_exponent ? -explicit_exponent : explicit_exponent;
   }
 
   struct json_value *value = json_value_create(JSON_VALUE_TYPE_NUMBER);
@@ -127,6 +163,15 @@ parse_number(struct lexer *const lex) {
     return NULL;
   }
 
+  // When both the digits and the power of ten are exact doubles, one multiplication or division
+  // gives the correctly rounded result. That covers the pins, voltages and speeds in our events.
+  if (exact && mantissa <= ((uint64_t)1 << 53) && exponent >= -22 && exponent <= 22) {
+    double number = (double)mantissa;
+    number = (exponent < 0) ? number / POWERS_OF_TEN[-exponent] : number * POWERS_OF_TEN[exponent];
+    value->as.number = negative ? -number : number;
+    return value;
+  }
+
   // Copy the data into a buffer with enough room for the largest possible double.
   size_t nbytes = lexer_upto(lex) - start;
   if (nbytes >= sizeof(buffer) - 1) {
@@ -136,12 +181,7 @@ parse_number(struct lexer *const lex) {
   }
   memcpy(buffer, start, nbytes);
   buffer[nbytes] = '\0';
-  const int ret = sscanf(buffer, "%lf", &value->as.number);
-  if (ret != 1) {
-    ERROR("Failed to scanf the double. This is a bug. ret=%d buffer='%s'\n", ret, buffer);
-    json_value_destroy(value);
-    return NULL;
-  }
+  value->as.number = strtod(buffer, NULL);
 
   return value;
 }
@@ -381,10 +421,12 @@ parse_string(struct lexer *const lex, struct buffer *const buffer) {
       }
     }
     else {
-      lexer_consume(lex, 1);
-      if ((status = buffer_append_n(buffer, &c, 1)) != STATUS_OK) {
+      // Copy the run of plain characters up to the next quote or escape in one go.
+      const size_t nbytes = lexer_string_run(lex);
+      if ((status = buffer_append_n(buffer, lexer_upto(lex), nbytes)) != STATUS_OK) {
         goto fail;
       }
+      lexer_consume(lex, nbytes);
     }
   }
 
@@ -492,35 +534,117 @@ json_parse_n(const char *const input, const size_t input_nbytes) {
 // ================================================================================================
 // JSON value CRUD.
 // ================================================================================================
-enum status
-json_value_append(struct json_value *const array, struct json_value *const value) {
-  struct json_value_list *pair, *prev, *p;
+// Objects with more keys than this get a hash index for #json_value_get.
+#define INDEX_MIN_PAIRS 8
+#define INITIAL_PAIRS_CAPACITY 4
 
-  if (array->type != JSON_VALUE_TYPE_ARRAY) {
-    return STATUS_EINVAL;
+
+// FNV-1a.
+static uint32_t
+hash_key(const char *key) {
+  uint32_t hash = 2166136261u;
+  for (const uint8_t *c = (const uint8_t *)key; *c != '\0'; ++c) {
+    hash = (hash ^ *c) * 16777619u;
+  }
+  return hash;
+}
+
+
+// The index has twice as many slots as there are pairs allocated, so it is at most half full.
+static void
+index_insert(struct json_value *const object, const uint32_t position) {
+  const uint32_t mask = 2 * object->pairs_capacity - 1;
+  const char *const key = object->as.pairs[position].key;
+  uint32_t slot = hash_key(key) & mask;
+  while (object->index[slot] != 0 && strcmp(object->as.pairs[object->index[slot] - 1].key, key) != 0) {
+    slot = (slot + 1) & mask;
+  }
+  object->index[slot] = position + 1;
+}
+
+
+// The index is only an optimisation, so if it can't be allocated lookups fall back to a scan.
+static void
+index_build(struct json_value *const object) {
+  object->index = xcalloc(2 * object->pairs_capacity, sizeof(uint32_t));
+  if (object->index == NULL) {
+    return;
+  }
+  for (uint32_t i = 0; i != object->npairs; ++i) {
+    index_insert(object, i);
   }
+}
+
 
-  // Construct the pair.
-  pair = xmalloc(sizeof(struct json_value_list));
+// Adds an element to the end of an object or array, growing the storage geometrically so that
+// appending is amortised O(1). Returns the new element, or NULL if memory allocation failed.
+static struct json_value_list *
+append_pair(struct json_value *const container) {
+  if (container->npairs == container->pairs_capacity) {
+    const uint32_t capacity = container->pairs_capacity ? 2 * container->pairs_capacity : INITIAL_PAIRS_CAPACITY;
+    struct json_value_list *const pairs = xrealloc(container->as.pairs, capacity * sizeof(struct json_value_list));
+    if (pairs == NULL) {
+      ERROR0("malloc failed\n");
+      return NULL;
+    }
+    // The elements may have moved, so relink them.
+    for (uint32_t i = 0; i + 1 < container->npairs; ++i) {
+      pairs[i].next = &pairs[i + 1];
+    }
+    container->as.pairs = pairs;
+    container->pairs_capacity = capacity;
+    // The index is sized for the capacity, so it's rebuilt by the caller.
+    free(container->index);
+    container->index = NULL;
+  }
+
+  struct json_value_list *const pair = &container->as.pairs[container->npairs];
+  pair->key = NULL;
+  pair->value = NULL;
+  pair->next = NULL;
+  if (container->npairs != 0) {
+    container->as.pairs[container->npairs - 1].next = pair;
+  }
+  ++container->npairs;
+  return pair;
+}
+
+
+static enum status
+set_pair(struct json_value *const object, char *const key, struct json_value *const value) {
+  struct json_value_list *const pair = append_pair(object);
   if (pair == NULL) {
-    ERROR0("malloc failed\n");
     return STATUS_ENOMEM;
   }
-  pair->key = NULL;
+  pair->key = key;
   pair->value = value;
-  pair->next = NULL;
 
-  // Append it to the end of the list of pairs.
-  prev = NULL;
-  for (p = array->as.pairs; p != NULL; p = p->next) {
-    prev = p;
+  if (object->npairs > INDEX_MIN_PAIRS) {
+    if (object->index == NULL) {
+      index_build(object);
+    }
+    else {
+      index_insert(object, object->npairs - 1);
+    }
   }
-  if (prev == NULL) {
-    array->as.pairs = pair;
+
+  return STATUS_OK;
+}
+
+
+enum status
+json_value_append(struct json_value *const array, struct json_value *const value) {
+  struct json_value_list *pair;
+
+  if (array->type != JSON_VALUE_TYPE_ARRAY) {
+    return STATUS_EINVAL;
   }
-  else {
-    prev->next = pair;
+
+  pair = append_pair(array);
+  if (pair == NULL) {
+    return STATUS_ENOMEM;
   }
+  pair->value = value;
 
   return STATUS_OK;
 }
@@ -542,8 +666,6 @@ json_value_create(const enum json_value_type type) {
 
 void
 json_value_destroy(struct json_value *const value) {
-  struct json_value_list *pair, *next;
-
   if (value == NULL) {
     return;
   }
@@ -551,13 +673,12 @@ json_value_destroy(struct json_value *const value) {
   switch (value->type) {
   case JSON_VALUE_TYPE_ARRAY:
   case JSON_VALUE_TYPE_OBJECT:
-    for (pair = value->as.pairs; pair != NULL; ) {
-      next = pair->next;
-      free(pair->key);
-      json_value_destroy(pair->value);
-      free(pair);
-      pair = next;
+    for (uint32_t i = 0; i != value->npairs; ++i) {
+      free(value->as.pairs[i].key);
+      json_value_destroy(value->as.pairs[i].value);
     }
+    free(value->as.pairs);
+    free(value->index);
     break;
   case JSON_VALUE_TYPE_BOOLEAN:
   case JSON_VALUE_TYPE_NULL:
@@ -574,15 +695,25 @@ json_value_destroy(struct json_value *const value) {
 
 struct json_value *
 json_value_get(const struct json_value *object, const char *const key) {
-  struct json_value_list *pair;
-
   if (object->type != JSON_VALUE_TYPE_OBJECT) {
     return NULL;
   }
 
-  for (pair = object->as.pairs; pair != NULL; pair = pair->next) {
-    if (strcmp(pair->key, key) == 0) {
-      return pair->value;
+  if (object->index != NULL) {
+    const uint32_t mask = 2 * object->pairs_capacity - 1;
+    for (uint32_t slot = hash_key(key) & mask; object->index[slot] != 0; slot = (slot + 1) & mask) {
+      const struct json_value_list *const pair = &object->as.pairs[object->index[slot] - 1];
+      if (strcmp(pair->key, key) == 0) {
+        return pair->value;
+      }
+    }
+    return NULL;
+  }
+
+  // Backwards, so that a repeated key gives the value set last.
+  for (uint32_t i = object->npairs; i != 0; --i) {
+    if (strcmp(object->as.pairs[i - 1].key, key) == 0) {
+      return object->as.pairs[i - 1].value;
     }
   }
 
@@ -598,96 +729,81 @@ json_value_set(struct json_value *const object, const char *const key, struct js
 
 enum status
 json_value_set_n(struct json_value *const object, const char *const key, const size_t key_nbytes, struct json_value *const value) {
-  struct json_value_list *pair;
   char *key_copy;
+  enum status status;
 
   if (object->type != JSON_VALUE_TYPE_OBJECT) {
     return STATUS_EINVAL;
   }
 
-  // Allocate memory.
-  pair = xmalloc(sizeof(struct json_value_list));
   key_copy = xmalloc(key_nbytes + 1);
-  if (pair == NULL || key_copy == NULL) {
+  if (key_copy == NULL) {
     ERROR0("malloc failed\n");
-    free(pair);
-    free(key_copy);
     return STATUS_ENOMEM;
   }
   memcpy(key_copy, key, key_nbytes);
   key_copy[key_nbytes] = '\0';
 
-  // Construct the pair.
-  pair->key = key_copy;
-  pair->value = value;
-  pair->next = object->as.pairs;
-  object->as.pairs = pair;
-
-  return STATUS_OK;
+  status = set_pair(object, key_copy, value);
+  if (status != STATUS_OK) {
+    free(key_copy);
+  }
+  return status;
 }
 
 
 enum status
 json_value_set_nocopy(struct json_value *const object, char *const key, struct json_value *const value) {
-  struct json_value_list *pair;
-
   if (object->type != JSON_VALUE_TYPE_OBJECT) {
     return STATUS_EINVAL;
   }
 
-  // Construct the pair.
-  pair = xmalloc(sizeof(struct json_value_list));
-  if (pair == NULL) {
-    ERROR0("malloc failed\n");
-    return STATUS_ENOMEM;
-  }
-  pair->key = key;
-  pair->value = value;
-  pair->next = object->as.pairs;
-  object->as.pairs = pair;
-
-  return STATUS_OK;
+  return set_pair(object, key, value);
 }
 
 
+// The escape sequence for each byte, or NULL for bytes that are copied as they are. Control
+// characters without a short form are written as \u00XX.
+static const char *const ESCAPES[256] = {
+  "\\u0000", "\\u0001", "\\u0002", "\\u0003", "\\u0004", "\\u0005", "\\u0006", "\\u0007",
+  "\\b",     "\\t",     "\\n",     "\\u000b", "\\f",     "\\r",     "\\u000e", "\\u000f",
+  "\\u0010", "\\u0011", "\\u0012", "\\u0013", "\\u0014", "\\u0015", "\\u0016", "\\u0017",
+  "\\u0018", "\\u0019", "\\u001a", "\\u001b", "\\u001c", "\\u001d", "\\u001e", "\\u001f",
+  ['"'] = "\\\"",
+  ['/'] = "\\/",
+  ['\\'] = "\\\\",
+};
+
+
 enum status
 json_write_escape_string(struct buffer *const buffer, const char *const string) {
   enum status status;
+  const char *run = string;
+  const char *c;
+
+  // Most strings need little or no escaping, so reserve for the common case up front.
+  if ((status = buffer_reserve(buffer, strlen(string) + 2)) != STATUS_OK) {
+    return status;
+  }
   if ((status = buffer_append_n(buffer, "\"", 1)) != STATUS_OK) {
     return status;
   }
-  for (const uint8_t *c = (const uint8_t *)string; *c != '\0'; ++c) {
-    switch (*c) {
-    case '"':
-      status = buffer_append_n(buffer, "\\\"", 2);
-      break;
-    case '\\':
-      status = buffer_append_n(buffer, "\\\\", 2);
-      break;
-    case '/':
-      status = buffer_append_n(buffer, "\\/", 2);
-      break;
-    case '\b':
-      status = buffer_append_n(buffer, "\\b", 2);
-      break;
-    case '\f':
-      status = buffer_append_n(buffer, "\\f", 2);
-      break;
-    case '\n':
-      status = buffer_append_n(buffer, "\\n", 2);
-      break;
-    case '\r':
-      status = buffer_append_n(buffer, "\\r", 2);
-      break;
-    case '\t':
-      status = buffer_append_n(buffer, "\\t", 2);
-      break;
-    default:
-      status = buffer_append_n(buffer, c, 1);
+  // Copy each run of bytes that don't need escaping in one go.
+  for (c = string; *c != '\0'; ++c) {
+    const char *const escape = ESCAPES[(uint8_t)*c];
+    if (escape == NULL) {
+      continue;
     }
-    if (status != STATUS_OK) {
+    if ((status = buffer_append_n(buffer, run, c - run)) != STATUS_OK) {
       return status;
     }
+    if ((status = buffer_append(buffer, escape)) != STATUS_OK) {
+      return status;
+    }
+    run = c + 1;
+  }
+  if ((status = buffer_append_n(buffer, run, c - run)) != STATUS_OK) {
+    return status;
   }
   if ((status = buffer_append_n(buffer, "\"", 1)) != STATUS_OK) {
     return status;
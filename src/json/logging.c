@@ -59,6 +59,8 @@ void
 logging_log(const enum logging_level level, const char *const function_name, const char *const file_name, const int line_number, const char *const fmt, ...) {
   va_list args;
   const char *prefix = NULL;
+  // Nothing may have called logging_open, and errors shouldn't be lost or crash.
+  FILE *const out = (file != NULL) ? file : stderr;
   const time_t now = time(NULL);
   static char buf[128];
 
@@ -78,8 +80,8 @@ logging_log(const enum logging_level level, const char *const function_name, con
   }
 
   strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", localtime(&now));
-  fprintf(file, "%s[%s][%s:%s:%d]\033[0m ", prefix, buf, function_name, file_name, line_number);
+  fprintf(out, "%s[%s][%s:%s:%d]\033[0m ", prefix, buf, function_name, file_name, line_number);
   va_start(args, fmt);
-  vfprintf(file, fmt, args);
+  vfprintf(out, fmt, args);
   va_end(args);
 }
@@ -1,89 +1,168 @@
-#include <string>
-#include <algorithm>
+#include <math.h>
 #include <stdlib.h>
 #include <string.h>
+#include "ultoa.h"
+
+namespace {
+
+const char LOWER_DIGITS[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+const char UPPER_DIGITS[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+// "00" to "99", so that decimal output takes one division per two digits.
+const char DIGIT_PAIRS[] =
+  "0001020304050607080910111213141516171819"
+  "2021222324252627282930313233343536373839"
+  "4041424344454647484950515253545556575859"
+  "6061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
+
+size_t
+format_decimal(unsigned long value, char* out) {
+  size_t length = 1;
+  for (unsigned long rest = value; rest >= 10; rest /= 10) {
+    length++;
+  }
+  char* p = out + length;
+  *p = '\0';
+  while (value >= 100) {
+    const char* pair = DIGIT_PAIRS + (value % 100) * 2;
+    value /= 100;
+    *--p = pair[1];
+    *--p = pair[0];
+  }
+  if (value >= 10) {
+    *--p = DIGIT_PAIRS[value * 2 + 1];
+    *--p = DIGIT_PAIRS[value * 2];
+  } else {
+    *--p = '0' + value;
+  }
+  return length;
+}
 
-/**
-   * C++ version 0.4 std::string style "itoa":
-   * Contributions from Stuart Lowe, Ray-Yuan Sheu,
-   * Rodrigo de Salvo Braz, Luc Gallant, John Maloney
-   * and Brian Hunt
-   * http://www.strudel.org.uk/itoa/#newest
-   */
-template <class T>
-std::string __toa(T value, int base) {
-
-  std::string buf;
-
-  // check that the base if valid
-  if (base < 2 || base > 16) return buf;
-
-  enum { kMaxDigits = 35 };
-  buf.reserve( kMaxDigits ); // Pre-allocate enough space.
-
-  int quotient = value;
-
-  // Translating number to string with base:
+// Bases 2, 4, 8, 16 and 32, where each digit is a group of bits.
+size_t
+format_bits(unsigned long value, int shift, const char* digits, char* out) {
+  int bits = value ? 8 * sizeof(value) - __builtin_clzl(value) : 1;
+  size_t length = (bits + shift - 1) / shift;
+  unsigned long mask = (1UL << shift) - 1;
+  char* p = out + length;
+  *p = '\0';
   do {
-    buf += "0123456789abcdef"[ std::abs( quotient % base ) ];
-    quotient /= base;
-  } while ( quotient );
-
-  // Append the negative sign
-  if ( value < 0) buf += '-';
-
-  std::reverse( buf.begin(), buf.end() );
-  return buf;
+    *--p = digits[value & mask];
+    value >>= shift;
+  } while (value);
+  return length;
 }
 
-template <class T>
-std::string __utoa(T value, int base) {
-
-  std::string buf;
-
-  // check that the base if valid
-  if (base < 2 || base > 16) return buf;
+size_t
+format_radix(unsigned long value, int radix, const char* digits, char* out) {
+  size_t length = 1;
+  for (unsigned long rest = value; rest >= static_cast<unsigned long>(radix); rest /= radix) {
+    length++;
+  }
+  char* p = out + length;
+  *p = '\0';
+  do {
+    *--p = digits[value % radix];
+    value /= radix;
+  } while (value);
+  return length;
+}
 
-  enum { kMaxDigits = 35 };
-  buf.reserve( kMaxDigits ); // Pre-allocate enough space.
+size_t
+copy(const char* s, char* out) {
+  strcpy(out, s);
+  return strlen(s);
+}
 
-  int quotient = value;
+} // namespace
+
+size_t
+format_unsigned(unsigned long value, char* out, int radix, bool upper) {
+  const char* digits = upper ? UPPER_DIGITS : LOWER_DIGITS;
+  switch (radix) {
+    case 10: return format_decimal(value, out);
+    case 16: return format_bits(value, 4, digits, out);
+    case 8: return format_bits(value, 3, digits, out);
+    case 2: return format_bits(value, 1, digits, out);
+    case 4: return format_bits(value, 2, digits, out);
+    case 32: return format_bits(value, 5, digits, out);
+  }
+  if (radix < 2 || radix > 36) {
+    *out = '\0';
+    return 0;
+  }
+  return format_radix(value, radix, digits, out);
+}
 
-  // Translating number to string with base:
-  do {
-    buf += "0123456789abcdef"[ std::abs( quotient % base ) ];
-    quotient /= base;
-  } while ( quotient );
+size_t
+format_signed(long value, char* out, int radix, bool upper) {
+  if (radix == 10 && value < 0) {
+    *out = '-';
+    return 1 + format_decimal(0UL - static_cast<unsigned long>(value), out + 1);
+  }
+  return format_unsigned(static_cast<unsigned long>(value), out, radix, upper);
+}
 
-  std::reverse( buf.begin(), buf.end() );
-  return buf;
+size_t
+format_float(double value, unsigned char digits, char* out) {
+  if (isnan(value)) return copy("nan", out);
+  if (isinf(value)) return copy("inf", out);
+  if (value > 4294967040.0 || value < -4294967040.0) return copy("ovf", out);
+
+  char* p = out;
+  if (value < 0.0) {
+    *p++ = '-';
+    value = -value;
+  }
+
+  // Round correctly so that 1.999 to 2 places is "2.00"
+  double rounding = 0.5;
+  for (unsigned char i = 0; i < digits; ++i) {
+    rounding /= 10.0;
+  }
+  value += rounding;
+
+  unsigned long int_part = static_cast<unsigned long>(value);
+  double remainder = value - static_cast<double>(int_part);
+  p += format_decimal(int_part, p);
+
+  if (digits > 0) {
+    *p++ = '.';
+  }
+  // One digit at a time from the remainder, as the AVR core does, so the
+  // last places come out the same rather than as printf would round them.
+  while (digits-- > 0) {
+    remainder *= 10.0;
+    int digit = static_cast<int>(remainder);
+    *p++ = '0' + digit;
+    remainder -= digit;
+  }
+  *p = '\0';
+  return p - out;
 }
 
 char* ultoa( unsigned long __val, char* __s, int __radix )
 {
-  std::string result = __utoa(__val, __radix);
-  strcpy(__s, result.c_str());
-
+  format_unsigned(__val, __s, __radix);
   return __s;
 }
 char* ltoa( long __val, char* __s, int __radix )
 {
-  std::string result = __toa(__val, __radix);
-  strcpy(__s, result.c_str());
-
+  format_signed(__val, __s, __radix);
   return __s;
 }
 char* itoa( int __val, char* __s, int __radix )
 {
-  std::string result = __toa(__val, __radix);
-  strcpy(__s, result.c_str());
-
+  if (__radix == 10) {
+    format_signed(__val, __s, __radix);
+  } else {
+    format_unsigned(static_cast<unsigned int>(__val), __s, __radix);
+  }
   return __s;
 }
 char* utoa( unsigned int __val, char* __s, int __radix )
 {
-  std::string result = __utoa(__val, __radix);
-  strcpy(__s, result.c_str());
-
+  format_unsigned(__val, __s, __radix);
   return __s;
-}
\ No newline at end of file
+}
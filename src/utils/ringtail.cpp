@@ -0,0 +1,61 @@
+// Follow an update ring written by an update sink with ring=PATH, printing
+// each update as it would have gone down a pipe.
+//
+//   ringtail [-n] PATH
+//
+// Starts from the oldest update still in the ring, or with -n from the next
+// one written, and exits once the run has ended. Updates lost because we
+// fell too far behind are reported on stderr.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include "UpdateRing.h"
+
+int
+main(int argc, char** argv) {
+  bool from_oldest = true;
+  int arg = 1;
+  if (arg < argc && strcmp(argv[arg], "-n") == 0) {
+    from_oldest = false;
+    arg++;
+  }
+  if (arg + 1 != argc) {
+    fprintf(stderr, "usage: %s [-n] PATH\n", argv[0]);
+    return 2;
+  }
+  _sim::UpdateRingReader reader;
+  if (!reader.open(argv[arg], from_oldest)) {
+    fprintf(stderr, "%s: not an update ring\n", argv[arg]);
+    return 1;
+  }
+
+  std::string data;
+  _sim::UpdateType type;
+  uint64_t reported = 0;
+  for (;;) {
+    // Checked first, as anything written before the writer closed has to be
+    // read before we stop.
+    bool closed = reader.closed();
+    bool any = false;
+    while (reader.next(&data, &type)) {
+      if (reader.lost() != reported) {
+        fprintf(stderr, "lost %" PRIu64 " updates\n", reader.lost() - reported);
+        reported = reader.lost();
+      }
+      fwrite(data.data(), 1, data.size(), stdout);
+      any = true;
+    }
+    if (closed) {
+      break;
+    }
+    if (any) {
+      fflush(stdout);
+    } else {
+      usleep(1000);
+    }
+  }
+  fflush(stdout);
+  return 0;
+}
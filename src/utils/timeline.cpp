@@ -0,0 +1,123 @@
+// Query a timeline written by esplora-sim -r, printing JSON.
+//
+//   timeline FILE state US              every pin and mux channel at US
+//   timeline FILE edges PIN FROM TO     each change to PIN in [FROM, TO] us
+//   timeline FILE mux CHANNEL FROM TO   each change to a mux channel
+//   timeline FILE info                  pins, channels, blocks and end time
+//
+// Only the blocks covering the query are read, as "blocks_read" shows on
+// stderr.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include "TimelineReader.h"
+
+namespace {
+
+void
+usage(const char* argv0) {
+  fprintf(stderr,
+          "usage: %s FILE state US\n"
+          "       %s FILE edges PIN FROM_US TO_US\n"
+          "       %s FILE mux CHANNEL FROM_US TO_US\n"
+          "       %s FILE info\n",
+          argv0, argv0, argv0, argv0);
+  exit(2);
+}
+
+uint64_t
+number(const char* arg, const char* argv0) {
+  char* end;
+  uint64_t value = strtoull(arg, &end, 10);
+  if (*end || end == arg) {
+    usage(argv0);
+  }
+  return value;
+}
+
+void
+print_voltage(double voltage) {
+  if (isnan(voltage)) {
+    printf("null");
+  } else {
+    printf("%.6g", voltage);
+  }
+}
+
+} // namespace
+
+int
+main(int argc, char** argv) {
+  if (argc < 3) {
+    usage(argv[0]);
+  }
+  _sim::TimelineReader reader;
+  if (!reader.open(argv[1])) {
+    fprintf(stderr, "%s: %s\n", argv[1], reader.error().c_str());
+    return 1;
+  }
+  const char* query = argv[2];
+
+  if (strcmp(query, "info") == 0 && argc == 3) {
+    printf("{\"pins\": %d, \"mux_channels\": %d, \"blocks\": %zu, \"end_us\": %" PRIu64 "}\n", reader.pins(),
+           reader.mux_channels(), reader.blocks(), reader.end_us());
+  } else if (strcmp(query, "state") == 0 && argc == 4) {
+    uint64_t us = number(argv[3], argv[0]);
+    // Laid out as in arduino_pins updates, plus the mux voltages.
+    std::vector<_sim::TimelinePin> pins;
+    for (int pin = 0; pin < reader.pins(); pin++) {
+      pins.push_back(reader.pin_at(pin, us));
+    }
+    printf("{\"us\": %" PRIu64 ", \"p\": [", us);
+    for (size_t i = 0; i < pins.size(); i++) {
+      printf("%s%d", i ? "," : "", pins[i].state);
+    }
+    printf("], \"pwmd\": [");
+    for (size_t i = 0; i < pins.size(); i++) {
+      printf("%s%" PRIu32, i ? "," : "", pins[i].pwm_high_time);
+    }
+    printf("], \"pwmp\": [");
+    for (size_t i = 0; i < pins.size(); i++) {
+      printf("%s%" PRIu32, i ? "," : "", pins[i].pwm_period);
+    }
+    printf("], \"mux\": [");
+    for (int channel = 0; channel < reader.mux_channels(); channel++) {
+      printf("%s", channel ? "," : "");
+      print_voltage(reader.mux_at(channel, us).voltage);
+    }
+    printf("]}\n");
+  } else if (strcmp(query, "edges") == 0 && argc == 6) {
+    int pin = number(argv[3], argv[0]);
+    if (pin >= reader.pins()) {
+      fprintf(stderr, "No pin %d\n", pin);
+      return 1;
+    }
+    for (const _sim::TimelinePin& change : reader.pin_changes(pin, number(argv[4], argv[0]), number(argv[5], argv[0]))) {
+      printf("{\"us\": %" PRIu64 ", \"state\": %d, \"pwmd\": %" PRIu32 ", \"pwmp\": %" PRIu32 "}\n", change.us,
+             change.state, change.pwm_high_time, change.pwm_period);
+    }
+  } else if (strcmp(query, "mux") == 0 && argc == 6) {
+    int channel = number(argv[3], argv[0]);
+    if (channel >= reader.mux_channels()) {
+      fprintf(stderr, "No mux channel %d\n", channel);
+      return 1;
+    }
+    for (const _sim::TimelineMux& change :
+         reader.mux_changes(channel, number(argv[4], argv[0]), number(argv[5], argv[0]))) {
+      printf("{\"us\": %" PRIu64 ", \"voltage\": ", change.us);
+      print_voltage(change.voltage);
+      printf("}\n");
+    }
+  } else {
+    usage(argv[0]);
+  }
+
+  if (!reader.error().empty()) {
+    fprintf(stderr, "%s: %s\n", argv[1], reader.error().c_str());
+    return 1;
+  }
+  fprintf(stderr, "blocks_read: %zu of %zu\n", reader.blocks_read(), reader.blocks());
+  return 0;
+}